@@ -0,0 +1,15 @@
+#pragma once
+
+#ifdef _WIN32
+#   ifdef KVOICE_STATIC
+#       define KVOICE_API
+#   else
+#       ifdef EXPORT_KVOICE_API
+#           define KVOICE_API __declspec(dllexport)
+#       else
+#           define KVOICE_API __declspec(dllimport)
+#       endif
+#   endif
+#else
+#   define KVOICE_API
+#endif
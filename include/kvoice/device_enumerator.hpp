@@ -0,0 +1,103 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "api.hpp"
+
+namespace kvoice {
+/**
+ * @brief immutable snapshot of OpenAL device lists
+ */
+struct device_list {
+    std::vector<std::string> input_devices{};
+    std::vector<std::string> output_devices{};
+    std::string              default_input{};
+    std::string              default_output{};
+    /**
+     * @brief count of refreshes that changed the lists, 0 until the first enumeration completes
+     */
+    std::uint64_t generation{ 0 };
+};
+
+enum class device_type : std::uint8_t {
+    input,
+    output
+};
+
+enum class device_change : std::uint8_t {
+    added,
+    removed,
+    default_changed
+};
+
+/**
+ * @brief type of user defined callback that being called when device lists change
+ * @param type type of changed device
+ * @param change kind of change
+ * @param device_name name of added or removed device, or name of the new default device
+ */
+using on_device_change_t = void(device_type type, device_change change, std::string_view device_name);
+
+/**
+ * @brief caches device lists and refreshes them on a background thread
+ * @details refresh happens every poll interval, and immediately on ALC_SOFT_system_events notifications
+ * if OpenAL supports them. OpenAL has a single event callback per process, so only one enumerator
+ * should exist at a time
+ */
+class KVOICE_API device_enumerator {
+public:
+    /**
+     * @brief Constructor, starts the first enumeration in background
+     * @param poll_interval interval between refreshes
+     */
+    explicit device_enumerator(std::chrono::milliseconds poll_interval = std::chrono::seconds{ 2 });
+    ~device_enumerator();
+
+    device_enumerator(const device_enumerator&) = delete;
+    device_enumerator& operator=(const device_enumerator&) = delete;
+
+    /**
+     * @brief gets latest device lists without enumerating, safe to call from any thread
+     * @return shared snapshot, empty with zero generation until the first enumeration completes
+     */
+    [[nodiscard]] std::shared_ptr<const device_list> get_devices() const;
+
+    /**
+     * @brief sets callback called on the enumerator thread for every change after the first enumeration
+     * @param cb user callback
+     */
+    void set_change_callback(std::function<on_device_change_t> cb);
+
+    /**
+     * @brief requests refresh without waiting for it
+     */
+    void refresh();
+
+    /**
+     * @brief checks if refreshes are triggered by OpenAL system events
+     */
+    [[nodiscard]] bool has_system_events() const { return system_events; }
+
+private:
+    void process();
+    void publish(std::shared_ptr<device_list> devices);
+
+    mutable std::mutex                 enumerator_mutex;
+    std::condition_variable            refresh_cv;
+    std::shared_ptr<const device_list> snapshot;
+    std::function<on_device_change_t>  on_change{};
+    std::chrono::milliseconds          interval;
+    bool                               refresh_requested{ false };
+    bool                               alive{ true };
+    bool                               system_events{ false };
+    std::thread                        enumerator_thread;
+};
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+#include "latency_profile.hpp"
+#include "sample_format.hpp"
+#include "sound_input.hpp"
+#include "thread_config.hpp"
+
+namespace kvoice {
+/**
+ * @brief parameters of @p encoder_farm::create_source
+ */
+struct encoder_source_config {
+    /**
+     * @brief sampling rate of pushed samples and of the opus encoder(8000, 12000, 16000, 24000 or 48000)
+     */
+    std::uint32_t sample_rate{ 48000 };
+    /**
+     * @brief encoder bitrate
+     */
+    std::uint32_t bitrate{ 32000 };
+    /**
+     * @brief format of pushed samples
+     */
+    sample_format format{ sample_format::float32 };
+    /**
+     * @brief duration of one encoded packet in ms, 0 for one encoder frame per packet
+     * @details same packetization as @p sound_input_config::packet_duration_ms
+     */
+    std::uint32_t packet_duration_ms{ 0 };
+    /**
+     * @brief max duration of samples queued for encoding, @p push_pcm rejects blocks over it
+     */
+    std::uint32_t max_queued_ms{ 1000 };
+    /**
+     * @brief encoder frame granularity, see @p sound_input_config::profile
+     */
+    latency_profile profile{ latency_profile::standard };
+    /**
+     * @brief samples per encoder frame at @p sample_rate, 0 for the @p profile default
+     */
+    std::uint32_t frame_size{ 0 };
+};
+
+/**
+ * @brief logical PCM source encoded by the workers of @p encoder_farm
+ * @details pushed samples are framed exactly like captured samples of @p sound_input: split into frames of
+ * @p encoder_source_config::frame_size samples(or the profile default), leftovers are kept until the next push.
+ * Blocks of a source are encoded in push order, by one worker at a time
+ */
+class encoder_source {
+public:
+    /**
+     * @brief destructor, drops queued blocks and waits for the block being encoded
+     */
+    virtual ~encoder_source() = default;
+
+    /**
+     * @brief copies samples and queues them for encoding, safe to call from any thread
+     * @param samples samples in @p sample_format passed on creation
+     * @param count count of samples in @p samples
+     * @return false if the queue is full, the block is dropped and counted in @p input_stats::overruns
+     */
+    virtual bool push_pcm(const void* samples, std::size_t count) = 0;
+    /**
+     * @brief sets gain applied to blocks pushed after the call
+     * @param gain float value from 0.0 to 1.0
+     */
+    virtual void set_gain(float gain) = 0;
+    /**
+     * @brief waits until every pushed block is encoded
+     */
+    virtual void flush() = 0;
+
+    /**
+     * @brief takes snapshot of encoding statistics, safe to call from any thread
+     * @details @p captured_samples counts pushed samples, @p capture_backlog counts queued samples,
+     * @p overruns counts rejected blocks
+     * @return encoding statistics
+     */
+    [[nodiscard]] virtual input_stats get_stats() const = 0;
+};
+
+/**
+ * @brief parameters of @p create_encoder_farm
+ */
+struct encoder_farm_config {
+    /**
+     * @brief count of worker threads, 0 for hardware concurrency
+     */
+    std::uint32_t worker_count{ 0 };
+    /**
+     * @brief scheduling parameters of every worker thread
+     */
+    thread_config worker_thread{};
+    /**
+     * @brief resource of the farm, its sources, queued blocks and opus encoders, nullptr for
+     * std::pmr::get_default_resource()
+     * @details the resource should be thread safe(blocks are pushed and encoded on different threads) and
+     * outlive the farm
+     */
+    std::pmr::memory_resource* memory_resource{ nullptr };
+};
+
+/**
+ * @brief bounded pool of encoder threads shared by many device-less PCM sources
+ * @details sources are encoded in round robin, a few blocks at a time, so throughput scales with the worker
+ * count instead of the source count
+ * @warning sources should be destroyed before the farm
+ */
+class encoder_farm {
+public:
+    /**
+     * @brief destructor, encodes blocks already queued and joins the workers
+     */
+    virtual ~encoder_farm() = default;
+
+    /**
+     * @brief creates new source
+     * @param config source parameters
+     * @param cb callback called on a worker thread with every encoded packet, in order
+     * @return pointer to source
+     * @throws voice_exception if encoder couldn't be created, frame size isn't a valid opus frame or packet
+     * duration isn't a multiple of frame
+     */
+    virtual std::unique_ptr<encoder_source> create_source(const encoder_source_config&    config,
+                                                          std::function<on_voice_input_t> cb) = 0;
+
+    /**
+     * @brief gets count of worker threads
+     */
+    [[nodiscard]] virtual std::uint32_t get_worker_count() const = 0;
+
+    /**
+     * @brief gets scheduling parameters every worker actually got, safe to call from any thread
+     */
+    [[nodiscard]] virtual std::vector<thread_report> get_thread_reports() const = 0;
+};
+}
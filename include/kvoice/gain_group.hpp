@@ -0,0 +1,35 @@
+#pragma once
+
+namespace kvoice {
+/**
+ * @brief named volume control shared by streams, like team, proximity or radio voice
+ * @details groups form a tree, gain of a stream is its own gain multiplied by the gains of its group and all of
+ * the group parents. Changing a group is O(1), streams pick the new gain up on their next @p stream::update,
+ * it is applied by OpenAL at playout, so already buffered audio is affected too
+ */
+class gain_group {
+public:
+    /**
+     * @brief destructor
+     */
+    virtual ~gain_group() = default;
+
+    /**
+     * @brief sets gain of the group, safe to call from any thread
+     * @param gain group gain, from 0 to 1
+     */
+    virtual void set_gain(float gain) = 0;
+
+    /**
+     * @brief gets gain of the group
+     * @return group gain
+     */
+    [[nodiscard]] virtual float get_gain() const = 0;
+
+    /**
+     * @brief gets gain of the group multiplied by gains of its parents
+     * @return effective gain
+     */
+    [[nodiscard]] virtual float get_effective_gain() const = 0;
+};
+}
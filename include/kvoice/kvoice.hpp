@@ -1,25 +1,22 @@
 ﻿#pragma once
 
+#include "api.hpp"
+#include "device_enumerator.hpp"
+#include "encoder_farm.hpp"
+#include "gain_group.hpp"
+#include "latency_profile.hpp"
+#include "packet_log.hpp"
+#include "sample_format.hpp"
 #include "sound_input.hpp"
 #include "sound_output.hpp"
+#include "thread_config.hpp"
+#include "trace.hpp"
 
+#include <functional>
+#include <memory_resource>
 #include <vector>
 #include <string>
 
-#ifdef _WIN32
-#   ifdef KVOICE_STATIC
-#       define KVOICE_API
-#   else
-#       ifdef EXPORT_KVOICE_API
-#           define KVOICE_API __declspec(dllexport)
-#       else
-#           define KVOICE_API __declspec(dllimport)
-#       endif
-#   endif
-#else
-#   define KVOICE_API
-#endif
-
 namespace kvoice {
 /**
  * @brief for internal usage
@@ -53,6 +50,131 @@ struct create_sound_device_result {
     std::string error_msg;
 };
 
+/**
+ * @brief type of user defined callback that being called once asynchronously created device is open
+ * @param success true if device is open
+ * @param error_msg empty if device is open, else contains error message
+ */
+using on_device_ready_t = void(bool success, std::string_view error_msg);
+
+/**
+ * @brief parameters of @p create_sound_output
+ * @warning @p device_name should outlive the call only, it isn't stored
+ */
+struct sound_output_config {
+    /**
+     * @brief name of output device(empty for default)
+     */
+    std::string_view device_name{};
+    /**
+     * @brief opus decoder sampling rate of streams
+     * @details streams are mixed at the device native rate(ALC_FREQUENCY), decoded audio is resampled to it
+     */
+    std::uint32_t sample_rate{ 48000 };
+    /**
+     * @brief count of max sound sources
+     */
+    std::uint32_t src_count{ 32 };
+    /**
+     * @brief format of decoded samples in stream buffers
+     */
+    sample_format format{ sample_format::float32 };
+    /**
+     * @brief locks ring buffers and scratch buffers of every stream in memory and pre-faults them
+     * @details each stream locks about 1 MB(float32) or 0.5 MB(int16), limited by RLIMIT_MEMLOCK on POSIX
+     */
+    bool lock_memory{ false };
+    /**
+     * @brief time without pushed audio after which a silent stream hibernates, in ms, 0 to never hibernate
+     * @details hibernated stream returns its ring buffer, opus decoder and OpenAL buffers to pools of the output
+     * and keeps only its settings, the next push takes them back from the pools
+     */
+    std::uint32_t hibernate_after_ms{ 0 };
+    /**
+     * @brief count of released stream resources kept in the pools for waking streams, the rest is freed
+     */
+    std::uint32_t hibernate_pool_size{ 8 };
+    /**
+     * @brief granularity of OpenAL buffers and of the device mixing period
+     * @details low latency streams upload 5 ms buffers, up to 4 of them queued, start playback with 0-20 ms of
+     * adaptive buffering and the device mixes every 5 ms(ALC_REFRESH 200)
+     */
+    latency_profile profile{ latency_profile::standard };
+    /**
+     * @brief device mixing frequency in Hz(ALC_REFRESH), 0 for the @p profile default
+     */
+    std::uint32_t refresh_rate{ 0 };
+    /**
+     * @brief resource of the output, its streams, ring buffers, pools and opus decoders, nullptr for
+     * std::pmr::get_default_resource()
+     * @details allocations made by OpenAL itself don't go through it. The resource should be thread safe
+     * (streams may be pushed from other threads) and outlive the output
+     */
+    std::pmr::memory_resource* memory_resource{ nullptr };
+};
+
+/**
+ * @brief parameters of @p create_sound_input
+ * @warning @p device_name should outlive the call only, it isn't stored
+ */
+struct sound_input_config {
+    /**
+     * @brief name of input device(empty for default)
+     */
+    std::string_view device_name{};
+    /**
+     * @brief input device sampling rate
+     */
+    std::uint32_t sample_rate{ 48000 };
+    /**
+     * @brief count of frames captured every tick
+     */
+    std::uint32_t frames_per_buffer{ 480 };
+    /**
+     * @brief encoder bitrate
+     */
+    std::uint32_t bitrate{ 32000 };
+    /**
+     * @brief format of captured samples, also passed to raw input callback
+     */
+    sample_format format{ sample_format::float32 };
+    /**
+     * @brief capture device sampling rate, 0 to capture at @p sample_rate
+     * @details set to the device native rate to resample once with kvoice resampler instead of OpenAL backend,
+     * @p frames_per_buffer and raw input callback are in device rate samples
+     */
+    std::uint32_t device_sample_rate{ 0 };
+    /**
+     * @brief duration of one encoded packet in ms, 0 for one encoder frame per packet
+     * @details encoder frame is @p frame_size samples, by default 480 samples at @p sample_rate(10 ms at
+     * 48 kHz) or 5 ms in the low latency profile, frames are combined with
+     * opus repacketizer, so the duration should be a multiple of frame duration, up to 120 ms
+     */
+    std::uint32_t packet_duration_ms{ 0 };
+    /**
+     * @brief encoder frame and capture read granularity
+     * @details low latency profile encodes 5 ms frames with OPUS_APPLICATION_RESTRICTED_LOWDELAY and reads
+     * the capture device every frame instead of every @p frames_per_buffer
+     */
+    latency_profile profile{ latency_profile::standard };
+    /**
+     * @brief samples per encoder frame at @p sample_rate, 0 for the @p profile default
+     * @details opus frame duration: 2.5, 5, 10, 20, 40 or 60 ms
+     */
+    std::uint32_t frame_size{ 0 };
+    /**
+     * @brief scheduling parameters of the capture thread, see @p sound_input::get_thread_report
+     */
+    thread_config capture_thread{};
+    /**
+     * @brief resource of the input, its capture buffers, resampler and opus encoder, nullptr for
+     * std::pmr::get_default_resource()
+     * @details allocations made by OpenAL itself don't go through it. The resource should be thread safe
+     * (the capture thread allocates its buffers) and outlive the input
+     */
+    std::pmr::memory_resource* memory_resource{ nullptr };
+};
+
 /**
  * @brief transforms internal OpenAL device list, and returns it
  * @return list of OpenAL input devices
@@ -67,7 +189,7 @@ KVOICE_API std::vector<std::string> get_output_devices();
 /**
  * @brief creates OpenAL sound output device
  * @param device_name name of output device
- * @param sample_rate output device sampling rate
+ * @param sample_rate opus decoder sampling rate of streams
  * @param src_count count of max sound sources
  * @return pointer to sound device if successful, else error message string
  */
@@ -86,4 +208,46 @@ KVOICE_API create_sound_device_result<sound_input> create_sound_input(std::strin
                                                                       std::uint32_t    sample_rate,
                                                                       std::uint32_t    frames_per_buffer,
                                                                       std::uint32_t    bitrate);
+
+/**
+ * @brief creates OpenAL sound output device
+ * @param config output device parameters
+ * @return pointer to sound device if successful, else error message string
+ */
+KVOICE_API create_sound_device_result<sound_output> create_sound_output(const sound_output_config& config);
+/**
+ * @brief creates OpenAL sound input device
+ * @param config input device parameters
+ * @return pointer to sound device if successful, else error message string
+ */
+KVOICE_API create_sound_device_result<sound_input> create_sound_input(const sound_input_config& config);
+
+/**
+ * @brief creates OpenAL sound output device without waiting for the device to open
+ * @details device is open on a background thread. Streams can be created and all settings can be changed
+ * right away, they are applied once the device is open. Packets pushed before that are buffered(up to 64 per
+ * stream) and played once the device is open. If the device fails to open, streams stay silent
+ * @param config output device parameters
+ * @param on_ready callback called on the background thread once the device is open or failed to open
+ * @return pointer to sound device, error message only if arguments are invalid
+ */
+KVOICE_API create_sound_device_result<sound_output> create_sound_output_async(
+    const sound_output_config& config, std::function<on_device_ready_t> on_ready = {});
+/**
+ * @brief creates OpenAL sound input device without waiting for the device to open
+ * @details device is open on the capture thread. Input can be enabled right away, capture starts once
+ * the device is open
+ * @param config input device parameters
+ * @param on_ready callback called on the capture thread once the device is open or failed to open
+ * @return pointer to sound device if arguments are valid, else error message string
+ */
+KVOICE_API create_sound_device_result<sound_input> create_sound_input_async(
+    const sound_input_config& config, std::function<on_device_ready_t> on_ready = {});
+
+/**
+ * @brief creates pool of opus encoders for device-less PCM sources
+ * @param config farm parameters
+ * @return pointer to farm
+ */
+KVOICE_API create_sound_device_result<encoder_farm> create_encoder_farm(const encoder_farm_config& config = {});
 }
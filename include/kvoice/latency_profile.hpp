@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+
+namespace kvoice {
+/**
+ * @brief trade-off between latency and robustness of the audio pipeline
+ */
+enum class latency_profile : std::uint8_t {
+    /**
+     * @brief 10 ms encoder frames, large OpenAL buffers with a deep queue, device default mixing period
+     */
+    standard,
+    /**
+     * @brief for LAN and esports use: 5 ms low delay encoder frames, 5 ms OpenAL buffers with a shallow queue
+     * and 5 ms device mixing period
+     * @details streams have to be updated at least every 10 ms, else they underrun
+     */
+    low_latency
+};
+}
@@ -0,0 +1,240 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+#include "api.hpp"
+
+namespace kvoice {
+class stream;
+
+/**
+ * @brief header at the start of packet log file
+ * @details file layout is header, then @p index_capacity entries, then packet payloads,
+ * all integers are little-endian
+ */
+struct packet_log_header {
+    static constexpr std::uint32_t kMagic = 0x4C50564B; // "KVPL"
+    static constexpr std::uint32_t kVersion = 1;
+    /**
+     * @brief set in @p flags when the log was closed, a log without it was cut off while recording
+     */
+    static constexpr std::uint32_t kFlagClosed = 1;
+
+    std::uint32_t magic{ kMagic };
+    std::uint32_t version{ kVersion };
+    /**
+     * @brief opus sampling rate of recorded packets, informational
+     */
+    std::uint32_t sample_rate{ 0 };
+    std::uint32_t flags{ 0 };
+    /**
+     * @brief count of entries reserved in index
+     */
+    std::uint64_t index_capacity{ 0 };
+    /**
+     * @brief count of recorded packets, first @p packet_count index entries are valid
+     * @details updated while recording, entries past it may be valid too if the log isn't closed
+     */
+    std::uint64_t packet_count{ 0 };
+    /**
+     * @brief offset of the first payload from the file start
+     */
+    std::uint64_t payload_offset{ 0 };
+    std::uint64_t reserved2[3]{};
+};
+
+/**
+ * @brief fixed-size index entry of one recorded packet
+ */
+struct packet_log_entry {
+    /**
+     * @brief user defined id of the stream or input that produced the packet
+     */
+    std::uint32_t stream_id{ 0 };
+    /**
+     * @brief per-stream packet number, starting from 0
+     */
+    std::uint32_t sequence{ 0 };
+    /**
+     * @brief time of recording relative to log creation, in us
+     */
+    std::uint64_t timestamp_us{ 0 };
+    /**
+     * @brief offset of packet payload from the file start
+     */
+    std::uint64_t offset{ 0 };
+    /**
+     * @brief size of packet payload in bytes
+     */
+    std::uint32_t size{ 0 };
+    std::uint32_t reserved{ 0 };
+};
+
+static_assert(sizeof(packet_log_header) == 64, "packet log header layout changed");
+static_assert(sizeof(packet_log_entry) == 32, "packet log entry layout changed");
+
+/**
+ * @brief records opus packets of many streams into a packet log file
+ * @details file is preallocated and mapped, @p record reserves index and payload space with atomic increments and
+ * copies the packet in place, so it never locks or blocks on file writes. Index entries are written as packets
+ * arrive, a log cut off by a crash can be read up to its last complete entry
+ */
+class KVOICE_API packet_log_writer {
+public:
+    /**
+     * @brief max count of distinct stream ids that get their own packet sequence
+     */
+    static constexpr std::size_t kMaxStreams = 4096;
+
+    /**
+     * @brief Constructor
+     * @param path path of the log file, overwritten if exists
+     * @param index_capacity max count of recorded packets
+     * @param payload_capacity max total size of recorded packets in bytes
+     * @param sample_rate opus sampling rate stored in the header
+     * @throws voice_exception if file couldn't be created or mapped
+     */
+    packet_log_writer(std::string_view path, std::uint64_t index_capacity, std::uint64_t payload_capacity,
+                      std::uint32_t    sample_rate);
+    ~packet_log_writer();
+
+    packet_log_writer(const packet_log_writer&) = delete;
+    packet_log_writer& operator=(const packet_log_writer&) = delete;
+
+    /**
+     * @brief appends packet to the log, lock-free
+     * @param stream_id user defined id of the packet source
+     * @param packet opus packet
+     * @param size size of @p packet
+     * @return false if index or payload space is full, log is closed or @p kMaxStreams ids are already recorded
+     */
+    bool record(std::uint32_t stream_id, const void* packet, std::size_t size);
+
+    /**
+     * @brief waits for records in progress, finalizes the header and trims unused payload space,
+     * further records are rejected
+     * @return true on success
+     */
+    bool close();
+
+    /**
+     * @brief count of rejected packets
+     */
+    [[nodiscard]] std::uint64_t dropped() const { return dropped_packets.load(std::memory_order_relaxed); }
+
+private:
+    /**
+     * @brief takes next sequence number of the stream
+     * @return false if stream id table is full
+     */
+    bool next_sequence(std::uint32_t stream_id, std::uint32_t& sequence);
+    /**
+     * @brief raises header packet count once every reserved entry is written
+     * @param written count of written entries including the caller's
+     */
+    void publish_count(std::uint64_t written);
+    void unmap();
+
+    std::uint8_t*                         data{ nullptr };
+    std::uint64_t                         data_size{ 0 };
+    packet_log_header*                    header{ nullptr };
+    packet_log_entry*                     entries{ nullptr };
+    std::chrono::steady_clock::time_point start_time{};
+
+    std::atomic<bool>          closed{ false };
+    std::atomic<std::uint32_t> active_records{ 0 };
+    std::atomic<std::uint64_t> reserved_entries{ 0 };
+    std::atomic<std::uint64_t> written_entries{ 0 };
+    std::atomic<std::uint64_t> payload_end{ 0 };
+    std::atomic<std::uint64_t> dropped_packets{ 0 };
+
+    // open addressing table of stream id + 1, 0 marks a free slot
+    std::array<std::atomic<std::uint64_t>, kMaxStreams> sequence_keys{};
+    std::array<std::atomic<std::uint32_t>, kMaxStreams> sequences{};
+
+    // platform file and mapping handles
+    void* file_handle{ nullptr };
+    void* mapping_handle{ nullptr };
+    int   file_descriptor{ -1 };
+};
+
+/**
+ * @brief memory-mapped read-only view of a packet log file
+ * @details payloads are accessed in place, reading and replaying doesn't allocate per packet
+ */
+class KVOICE_API packet_log_reader {
+public:
+    /**
+     * @brief type of sink that receives replayed packets
+     * @param entry index entry of the packet
+     * @param payload packet payload
+     */
+    using packet_sink_t = void(const packet_log_entry& entry, const std::uint8_t* payload);
+
+    /**
+     * @brief Constructor
+     * @param path path of the log file
+     * @throws voice_exception if file couldn't be mapped or isn't a valid packet log
+     */
+    explicit packet_log_reader(std::string_view path);
+    ~packet_log_reader();
+
+    packet_log_reader(const packet_log_reader&) = delete;
+    packet_log_reader& operator=(const packet_log_reader&) = delete;
+
+    [[nodiscard]] const packet_log_header& header() const { return *log_header; }
+    /**
+     * @brief count of readable packets, includes complete entries past header packet count of a log that isn't closed
+     */
+    [[nodiscard]] std::size_t size() const { return packet_count; }
+
+    /**
+     * @brief gets index entry, entries are ordered by recording, timestamps of packets recorded at once from
+     * different threads may be out of order
+     * @param i entry number, less than @p size
+     */
+    [[nodiscard]] const packet_log_entry& entry(std::size_t i) const { return entries[i]; }
+
+    /**
+     * @brief gets payload of the entry
+     * @param e entry of this log
+     */
+    [[nodiscard]] const std::uint8_t* payload(const packet_log_entry& e) const { return data + e.offset; }
+
+    /**
+     * @brief passes all packets to the sink, keeping recorded intervals
+     * @param sink packet receiver, called on the calling thread
+     * @param speed replay speed multiplier, 0 to replay as fast as possible
+     * @param stop optional flag that interrupts the replay
+     * @return count of replayed packets
+     */
+    std::size_t replay(const std::function<packet_sink_t>& sink, float speed = 1.f,
+                       const std::atomic<bool>*            stop = nullptr) const;
+
+    /**
+     * @brief pushes all packets to streams, keeping recorded intervals
+     * @param resolve maps recorded stream id to a stream, packets of unresolved streams are skipped
+     * @param speed replay speed multiplier, 0 to replay as fast as possible
+     * @param stop optional flag that interrupts the replay
+     * @return count of pushed packets
+     */
+    std::size_t replay_to_streams(const std::function<stream*(std::uint32_t)>& resolve, float speed = 1.f,
+                                  const std::atomic<bool>*                      stop = nullptr) const;
+
+private:
+    void unmap();
+
+    const std::uint8_t*      data{ nullptr };
+    std::size_t              data_size{ 0 };
+    const packet_log_header* log_header{ nullptr };
+    const packet_log_entry*  entries{ nullptr };
+    std::size_t              packet_count{ 0 };
+    // platform file and mapping handles
+    void* file_handle{ nullptr };
+    void* mapping_handle{ nullptr };
+};
+}
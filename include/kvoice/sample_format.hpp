@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+
+namespace kvoice {
+/**
+ * @brief format of samples used by the whole device pipeline(codec, buffers, OpenAL)
+ */
+enum class sample_format : std::uint8_t {
+    /**
+     * @brief 32-bit float samples in range [-1.0, 1.0]
+     */
+    float32,
+    /**
+     * @brief 16-bit signed integer samples, halves buffer memory and copy volume
+     */
+    int16
+};
+}
@@ -1,7 +1,47 @@
 #pragma once
+#include <cstdint>
 #include <functional>
+#include <string_view>
+
+#include "thread_config.hpp"
 
 namespace kvoice {
+/**
+ * @brief snapshot of capture runtime statistics
+ * @details all values are gathered lock-free, so the snapshot is cheap enough to be taken every frame
+ */
+struct input_stats {
+    /**
+     * @brief count of samples read from the capture device
+     */
+    std::uint64_t captured_samples{ 0 };
+    /**
+     * @brief count of samples left in the capture device after the last read
+     */
+    std::uint32_t capture_backlog{ 0 };
+    /**
+     * @brief count of polls that found more than one full buffer in the capture device
+     * @details capture device drops the oldest samples if the backlog isn't drained in time
+     */
+    std::uint64_t overruns{ 0 };
+    /**
+     * @brief count of packets passed to the input callback
+     */
+    std::uint64_t encoded_packets{ 0 };
+    /**
+     * @brief count of frames and packets dropped because opus failed to encode or repacketize them
+     */
+    std::uint64_t dropped_packets{ 0 };
+    /**
+     * @brief count of packets dropped because packet queue was full
+     */
+    std::uint64_t queue_overflows{ 0 };
+    /**
+     * @brief average time spent in opus encoder per packet, in us
+     */
+    float avg_encode_time_us{ 0.f };
+};
+
 /**
  * @brief type of user defined callback that being called after processing
  * @param buffer buffer with data
@@ -10,11 +50,58 @@ namespace kvoice {
 using on_voice_input_t = void(const void* buffer, std::size_t size);
 /**
  * @brief type of user defined callback that being called before processing
- * @param buffer buffer with raw data
- * @param size size of @p buffer
+ * @param buffer buffer with raw samples in @p sample_format passed on creation
+ * @param size count of samples in @p buffer
  * @param mic_level max input volume
  */
 using on_voice_raw_input = void(const void* buffer, std::size_t size, float mic_level);
+/**
+ * @brief type of user defined callback that being called after processing, with capture time of the packet
+ * @param buffer buffer with data
+ * @param size size of @p buffer
+ * @param capture_time_us time the first sample of the packet was captured, in us of std::chrono::steady_clock
+ */
+using on_voice_timed_input_t = void(const void* buffer, std::size_t size, std::uint64_t capture_time_us);
+
+/**
+ * @brief encoded packet stored in the packet queue
+ */
+struct encoded_packet {
+    static constexpr std::size_t kMaxSize = 1500;
+
+    /**
+     * @brief opus packet
+     */
+    std::uint8_t data[kMaxSize];
+    /**
+     * @brief size of @p data in bytes
+     */
+    std::uint32_t size{ 0 };
+    /**
+     * @brief number of the packet since input creation, gaps mean dropped packets
+     */
+    std::uint32_t sequence{ 0 };
+    /**
+     * @brief time the packet was encoded, in us of std::chrono::steady_clock
+     */
+    std::uint64_t timestamp_us{ 0 };
+    /**
+     * @brief time the first sample of the packet was captured, in us of std::chrono::steady_clock
+     * @details estimated from the capture device backlog(and device latency if ALC_SOFT_device_clock is supported)
+     */
+    std::uint64_t capture_time_us{ 0 };
+};
+
+/**
+ * @brief native waitable handle, file descriptor on POSIX and event HANDLE on Windows
+ */
+#ifdef _WIN32
+using wakeup_handle_t = void*;
+#else
+using wakeup_handle_t = int;
+#endif
+
+class packet_log_writer;
 
 class sound_input {
 public:
@@ -54,5 +141,59 @@ public:
      * @param cb user callback
      */
     virtual void set_raw_input_callback(std::function<on_voice_raw_input> cb) = 0;
+    /**
+     * @brief sets input callback that also gets packet capture time, called instead of the input callback if set
+     * @details pass capture time to @p opus_packet::capture_time_us on the receiving stream to measure
+     * end-to-end latency
+     * @param cb user callback
+     */
+    virtual void set_timed_input_callback(std::function<on_voice_timed_input_t> cb) = 0;
+
+    /**
+     * @brief takes snapshot of capture statistics, safe to call from any thread
+     * @return capture statistics
+     */
+    [[nodiscard]] virtual input_stats get_stats() const = 0;
+
+    /**
+     * @brief gets scheduling parameters the capture thread actually got, safe to call from any thread
+     * @return capture thread report, @p started is false until the thread applies its config
+     */
+    [[nodiscard]] virtual thread_report get_thread_report() const = 0;
+
+    /**
+     * @brief records every encoded opus packet into the log before passing it to the input callback
+     * @param writer packet log that outlives recording, nullptr to stop recording
+     * @param stream_id id stored with recorded packets
+     */
+    virtual void set_packet_log(packet_log_writer* writer, std::uint32_t stream_id) = 0;
+
+    /**
+     * @brief switches delivery of encoded packets between input callback and packet queue
+     * @details in queue mode input callback isn't called, packets are dropped if queue is full. Queued packets are
+     * limited to @p encoded_packet::kMaxSize bytes, frames of packets whose bitrate times duration would exceed it
+     * (e.g. 128 kbps for 100 ms) are encoded at a lower bitrate
+     * @param enabled true to deliver packets to the queue
+     */
+    virtual void set_packet_queue_enabled(bool enabled) = 0;
+    /**
+     * @brief pops the oldest encoded packet from the packet queue, must be called from a single thread
+     * @param[out] packet popped packet
+     * @return false if queue is empty
+     */
+    virtual bool try_pop(encoded_packet& packet) = 0;
+    /**
+     * @brief pops up to @p max_count oldest encoded packets from the packet queue, must be called from a single thread
+     * @param[out] packets array of at least @p max_count packets
+     * @param max_count max count of popped packets
+     * @return count of popped packets
+     */
+    virtual std::size_t pop_batch(encoded_packet* packets, std::size_t max_count) = 0;
+    /**
+     * @brief gets handle that is readable while packet queue may have packets
+     * @details handle is reset by @p pop_batch and by @p try_pop on empty queue, it shouldn't be read or closed
+     * @return native waitable handle, valid for the input lifetime
+     */
+    [[nodiscard]] virtual wakeup_handle_t get_wakeup_handle() const = 0;
 };
 }
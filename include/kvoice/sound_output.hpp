@@ -2,6 +2,7 @@
 #include "kv_vector.hpp"
 #include <string_view>
 #include <memory>
+#include "gain_group.hpp"
 #include "stream.hpp"
 
 namespace kvoice {
@@ -44,6 +45,7 @@ public:
 
     /**
      * @brief Sets output gain
+     * @details applied as listener gain, so already buffered audio is affected too
      * @param gain Output gain, from 0 to 1
     */
     virtual void set_gain(float gain) = 0;
@@ -56,15 +58,79 @@ public:
     virtual void change_device(std::string_view device_name) = 0;
 
     /**
-     * @brief sets output buffering time
+     * @brief sets minimal output buffering time
+     * @details same as @p set_buffering_bounds with unchanged max bound
      * @param time_ms time in ms
      */
     virtual void set_buffering_time(std::uint32_t time_ms) = 0;
 
+    /**
+     * @brief sets bounds of adaptive stream buffering
+     * @details streams start(and restart after underrun) playback once they have buffered enough audio
+     * to cover their measured packet arrival jitter, clamped to [@p min_ms, @p max_ms]
+     * @param min_ms min amount of buffered audio before playback starts, in ms
+     * @param max_ms max amount of buffered audio before playback starts, in ms
+     */
+    virtual void set_buffering_bounds(std::uint32_t min_ms, std::uint32_t max_ms) = 0;
+
     /**
      * @brief creates new stream on output
+     * @details stream decodes opus at sampling rate passed on output creation
      * @return pointer to stream
      */
     virtual std::unique_ptr<stream> create_stream() = 0;
+
+    /**
+     * @brief creates new stream decoding opus at specific sampling rate
+     * @details decoded audio is resampled to the device rate before buffering
+     * @param sample_rate opus decoder sampling rate(8000, 12000, 16000, 24000 or 48000)
+     * @return pointer to stream
+     * @throws voice_exception if decoder couldn't be created
+     */
+    virtual std::unique_ptr<stream> create_stream(std::uint32_t sample_rate) = 0;
+    /**
+     * @brief sets positions of many streams in one call
+     * @details stream @p ids[i] gets position {@p xs[i], @p ys[i], @p zs[i]}, same as its set_position.
+     * Changes of streams playing now are passed to OpenAL as one batch. Unknown ids are skipped
+     * @param ids stream ids, see stream::get_id
+     * @param xs x coordinates
+     * @param ys y coordinates
+     * @param zs z coordinates
+     * @param count count of elements in every array
+     */
+    virtual void set_positions(const std::uint32_t* ids, const float* xs, const float* ys, const float* zs,
+                               std::size_t count) = 0;
+    /**
+     * @brief sets velocities of many streams in one call
+     * @details same as @p set_positions for velocity
+     */
+    virtual void set_velocities(const std::uint32_t* ids, const float* xs, const float* ys, const float* zs,
+                                std::size_t count) = 0;
+    /**
+     * @brief sets directions of many streams in one call
+     * @details same as @p set_positions for direction
+     */
+    virtual void set_directions(const std::uint32_t* ids, const float* xs, const float* ys, const float* zs,
+                                std::size_t count) = 0;
+    /**
+     * @brief sets min distances, max distances and rolloff factors of many streams in one call
+     * @details same as @p set_positions for set_min_distance, set_max_distance and set_rolloff_factor
+     */
+    virtual void set_distances(const std::uint32_t* ids, const float* min_distances, const float* max_distances,
+                               const float* rolloff_factors, std::size_t count) = 0;
+
+    /**
+     * @brief creates top level gain group
+     * @details group must be destroyed before the output, and after streams and groups using it
+     * @return pointer to gain group
+     */
+    virtual std::unique_ptr<gain_group> create_gain_group() = 0;
+
+    /**
+     * @brief creates gain group nested into @p parent
+     * @param parent group created by this output, its gain is applied on top of the new group gain
+     * @return pointer to gain group
+     */
+    virtual std::unique_ptr<gain_group> create_gain_group(gain_group& parent) = 0;
 };
 }
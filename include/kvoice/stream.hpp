@@ -1,9 +1,129 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include "gain_group.hpp"
 #include "kv_vector.hpp"
+#include "sample_format.hpp"
 
 namespace kvoice {
+/**
+ * @brief action taken when buffered audio exceeds the stream latency ceiling
+ */
+enum class overflow_policy : std::uint8_t {
+    /**
+     * @brief keep everything, latency is bounded only by the ring buffer size
+     */
+    none,
+    /**
+     * @brief drop the oldest samples exceeding the ceiling
+     */
+    drop_oldest,
+    /**
+     * @brief skip to the newest audio, leaving half of the ceiling buffered, and crossfade over the cut
+     */
+    skip_to_newest,
+    /**
+     * @brief remove silent parts of buffered audio first, then drop the oldest samples if still above the ceiling
+     */
+    compress_silence
+};
+
+/**
+ * @brief snapshot of stream runtime statistics
+ * @details all values are gathered lock-free, so the snapshot is cheap enough to be taken every frame
+ */
+struct stream_stats {
+    /**
+     * @brief count of decoded samples waiting in the stream ring buffer
+     */
+    std::uint32_t buffered_samples{ 0 };
+    /**
+     * @brief audio buffered in the ring buffer and queued on the OpenAL source, in ms
+     */
+    float buffered_ms{ 0.f };
+    /**
+     * @brief time until the next pushed sample reaches the speaker, in ms
+     * @details based on AL_SEC_OFFSET_LATENCY_SOFT if supported, else on the source offset only
+     */
+    float playback_latency_ms{ 0.f };
+    /**
+     * @brief amount of buffered audio required to start playback, in ms
+     */
+    float target_buffer_ms{ 0.f };
+    /**
+     * @brief smoothed deviation of packet arrival intervals from packet durations, in ms
+     */
+    float arrival_jitter_ms{ 0.f };
+    /**
+     * @brief count of times the source ran out of queued data while playing
+     */
+    std::uint64_t underruns{ 0 };
+    /**
+     * @brief count of samples dropped because the ring buffer was full
+     */
+    std::uint64_t overrun_samples{ 0 };
+    /**
+     * @brief count of samples discarded by the overflow policy to keep latency below the ceiling
+     */
+    std::uint64_t discarded_samples{ 0 };
+    /**
+     * @brief part of @p discarded_samples that was removed as silence by @p overflow_policy::compress_silence
+     */
+    std::uint64_t discarded_silence_samples{ 0 };
+    /**
+     * @brief count of successfully decoded packets
+     */
+    std::uint64_t decoded_packets{ 0 };
+    /**
+     * @brief count of packets that opus failed to decode
+     */
+    std::uint64_t decode_errors{ 0 };
+    /**
+     * @brief average time spent in opus decoder per packet, in us
+     */
+    float avg_decode_time_us{ 0.f };
+    /**
+     * @brief time from capture to push of the last packet with @p opus_packet::capture_time_us, in ms
+     */
+    float capture_to_push_ms{ 0.f };
+    /**
+     * @brief time from push to the speaker of the last packet with @p opus_packet::capture_time_us, in ms
+     * @details measured once the first sample of the packet is uploaded to OpenAL, from the source offset
+     * and AL_SEC_OFFSET_LATENCY_SOFT if supported
+     */
+    float push_to_playout_ms{ 0.f };
+    /**
+     * @brief time from capture to the speaker of the last packet with @p opus_packet::capture_time_us, in ms
+     */
+    float capture_to_playout_ms{ 0.f };
+    /**
+     * @brief count of packets the latency fields were measured for
+     */
+    std::uint64_t latency_samples{ 0 };
+};
+
+/**
+ * @brief opus packet passed to @p stream::push_opus_buffers
+ */
+struct opus_packet {
+    /**
+     * @brief buffer with opus encoded data
+     */
+    const void* data{ nullptr };
+    /**
+     * @brief size of @p data
+     */
+    std::size_t size{ 0 };
+    /**
+     * @brief time the first sample of the packet was captured, in us of std::chrono::steady_clock, 0 if unknown
+     * @details see @p on_voice_timed_input_t, remote timestamps should be mapped to the local clock
+     */
+    std::uint64_t capture_time_us{ 0 };
+};
+
+class packet_log_writer;
+
 class stream {
 public:
     /**
@@ -19,6 +139,27 @@ public:
      */
     virtual bool push_opus_buffer(const void* data, std::size_t count) = 0;
 
+    /**
+     * @brief decodes batch of packets back to back and publishes them to the sound output at once
+     * @param packets array of packets in playback order
+     * @param count count of @p packets
+     * @return count of successfully decoded packets, packets that failed to decode are skipped
+     */
+    virtual std::size_t push_opus_buffers(const opus_packet* packets, std::size_t count) = 0;
+
+    /**
+     * @brief pushes raw samples straight to the sound output, without opus
+     * @details for locally generated audio, samples go through the same gain, resampling and buffering as
+     * decoded packets
+     * @param samples mono samples
+     * @param count count of samples in @p samples
+     * @param format format of @p samples
+     * @param sample_rate sampling rate of @p samples, resampled to the device rate if differs
+     * @return true if all samples were buffered, false if the buffer was full and some were dropped
+     */
+    virtual bool push_pcm_buffer(const void* samples, std::size_t count, sample_format format,
+                                 std::uint32_t sample_rate) = 0;
+
     /**
      * @brief sets source position
      * @param pos new source position
@@ -57,9 +198,23 @@ public:
     virtual void set_spatial_state(bool spatial_state) = 0;
     /**
      * @brief sets output gain
+     * @details applied by OpenAL at playout, so already buffered audio is affected too
      * @param gain new output gain
      */
     virtual void set_gain(float gain) = 0;
+    /**
+     * @brief puts stream into gain group, stream gain is multiplied by the effective gain of the group
+     * @param group group created by the output of this stream, nullptr to leave the group.
+     * Group must outlive the stream or be replaced before it is destroyed
+     */
+    virtual void set_gain_group(gain_group* group) = 0;
+
+    /**
+     * @brief sets latency ceiling of buffered audio, applied on every @p update
+     * @param max_latency_ms max audio buffered in the ring buffer and queued on the source, 0 to disable
+     * @param policy action taken when buffered audio exceeds @p max_latency_ms
+     */
+    virtual void set_max_latency(std::uint32_t max_latency_ms, overflow_policy policy) = 0;
 
     /**
      * @brief is playing sound now
@@ -72,5 +227,24 @@ public:
      * @return true on success, false on fail
      */
     virtual bool update() = 0;
+
+    /**
+     * @brief takes snapshot of stream statistics, safe to call from any thread
+     * @return stream statistics
+     */
+    [[nodiscard]] virtual stream_stats get_stats() const = 0;
+
+    /**
+     * @brief records every pushed opus packet into the log before decoding
+     * @param writer packet log that outlives recording, nullptr to stop recording
+     * @param stream_id id stored with recorded packets
+     */
+    virtual void set_packet_log(packet_log_writer* writer, std::uint32_t stream_id) = 0;
+
+    /**
+     * @brief gets id of the stream in bulk setters of its output, like sound_output::set_positions
+     * @details ids are small and dense, an id of destroyed stream is reused by the next created one
+     */
+    [[nodiscard]] virtual std::uint32_t get_id() const = 0;
 };
 }
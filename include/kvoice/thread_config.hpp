@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace kvoice {
+/**
+ * @brief scheduling policy of kvoice audio threads
+ */
+enum class thread_scheduling : std::uint8_t {
+    /**
+     * @brief default time-sharing scheduling
+     */
+    normal,
+    /**
+     * @brief SCHED_FIFO on POSIX, time critical priority on Windows
+     */
+    fifo,
+    /**
+     * @brief SCHED_RR on POSIX, time critical priority on Windows
+     */
+    round_robin
+};
+
+/**
+ * @brief scheduling parameters of a kvoice audio thread, applied by the thread itself when it starts
+ * @warning @p name should outlive the call only, it isn't stored
+ */
+struct thread_config {
+    /**
+     * @brief thread name shown by debuggers and profilers(empty for default), truncated to 15 chars on Linux
+     */
+    std::string_view name{};
+    /**
+     * @brief scheduling policy
+     * @details if real-time scheduling is denied, thread falls back to the highest allowed nice value
+     */
+    thread_scheduling scheduling{ thread_scheduling::normal };
+    /**
+     * @brief real-time priority, clamped to the range of @p scheduling(1-99 on Linux)
+     */
+    int priority{ 10 };
+    /**
+     * @brief bitmask of CPUs the thread may run on, 0 to keep inherited affinity
+     */
+    std::uint64_t affinity_mask{ 0 };
+    /**
+     * @brief locks thread buffers and device rings in memory and pre-faults them
+     * @details limited by RLIMIT_MEMLOCK on POSIX and by the working set size on Windows
+     */
+    bool lock_memory{ false };
+};
+
+/**
+ * @brief scheduling parameters the thread actually got
+ */
+struct thread_report {
+    /**
+     * @brief true once the thread started and applied its config
+     */
+    bool started{ false };
+    std::string       name{};
+    thread_scheduling scheduling{ thread_scheduling::normal };
+    /**
+     * @brief real-time priority for real-time scheduling, nice value on POSIX or thread priority on Windows otherwise
+     */
+    int priority{ 0 };
+    /**
+     * @brief bitmask of CPUs the thread may run on, 0 if unknown
+     */
+    std::uint64_t affinity_mask{ 0 };
+    bool          memory_locked{ false };
+    /**
+     * @brief description of settings that couldn't be applied, empty on full success
+     */
+    std::string errors{};
+};
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "api.hpp"
+
+namespace kvoice {
+/**
+ * @brief instrumented hot path locations
+ */
+enum class trace_point : std::uint8_t {
+    capture_samples,
+    opus_encode,
+    input_callback,
+    raw_input_callback,
+    opus_decode,
+    ring_write,
+    ring_read,
+    buffer_data,
+    count
+};
+
+/**
+ * @brief latency summary of one trace point on one thread
+ */
+struct trace_summary {
+    /**
+     * @brief instrumented location
+     */
+    trace_point point{ trace_point::count };
+    /**
+     * @brief human readable name of @p point
+     */
+    std::string_view name;
+    /**
+     * @brief sequential id of the recording thread
+     */
+    std::uint32_t thread_id{ 0 };
+    /**
+     * @brief count of recorded samples
+     */
+    std::uint64_t count{ 0 };
+    /**
+     * @brief latency percentiles and maximum, in ns
+     * @details percentiles are taken from a log-linear histogram, relative error is below 3.2%
+     */
+    std::uint64_t p50_ns{ 0 };
+    std::uint64_t p90_ns{ 0 };
+    std::uint64_t p99_ns{ 0 };
+    std::uint64_t p999_ns{ 0 };
+    std::uint64_t max_ns{ 0 };
+};
+
+/**
+ * @brief checks if kvoice was built with KVOICE_ENABLE_TRACING
+ * @return true if hot paths are instrumented
+ */
+KVOICE_API bool trace_enabled();
+
+/**
+ * @brief collects latency histograms of every thread that recorded a trace point
+ * @return summaries of non-empty histograms, empty if tracing is disabled
+ */
+KVOICE_API std::vector<trace_summary> trace_dump();
+
+/**
+ * @brief clears all histograms and recorded events
+ * @warning recordings made concurrently with reset may be partially kept
+ */
+KVOICE_API void trace_reset();
+
+/**
+ * @brief writes the most recent events of every thread as Chrome trace JSON(loadable by Perfetto)
+ * @param path output file path
+ * @return true on success, false if tracing is disabled or file couldn't be written
+ */
+KVOICE_API bool trace_export_chrome(std::string_view path);
+}
@@ -0,0 +1,356 @@
+#include "async_sound_output.hpp"
+
+#include <algorithm>
+
+#include "gain_group_impl.hpp"
+#include "sound_output_impl.hpp"
+#include "voice_exception.hpp"
+
+kvoice::deferred_stream::deferred_stream(async_sound_output* output, std::uint32_t sample_rate,
+                                         std::pmr::memory_resource* resource)
+    : owner(output),
+      sample_rate(sample_rate),
+      spatial_id(output->get_spatial_table().allocate()),
+      resource(resource),
+      kept_packets(resource) {
+}
+
+kvoice::deferred_stream::~deferred_stream() {
+    owner->unregister_stream(this);
+    // the real stream uses the row until it is destroyed
+    inner.reset();
+    owner->get_spatial_table().free(spatial_id);
+}
+
+template <typename Func, typename Keep>
+void kvoice::deferred_stream::apply(Func&& func, Keep&& keep) {
+    if (auto* s = ready_stream.load(std::memory_order_acquire)) return func(*s);
+
+    std::unique_lock lck(stream_mutex);
+    if (inner) func(*inner);
+    else keep();
+}
+
+kvoice::deferred_stream::kept_buffer& kvoice::deferred_stream::next_kept_buffer() {
+    if (kept_packets.size() < kMaxDeferredPackets) return kept_packets.emplace_back(resource);
+
+    // the oldest packet is dropped, its storage keeps the new one
+    kept_packets.push_back(std::move(kept_packets.front()));
+    kept_packets.pop_front();
+    return kept_packets.back();
+}
+
+bool kvoice::deferred_stream::push_opus_buffer(const void* data, std::size_t count) {
+    const opus_packet packet{ data, count };
+    return push_opus_buffers(&packet, 1) == 1;
+}
+
+std::size_t kvoice::deferred_stream::push_opus_buffers(const opus_packet* packets, std::size_t count) {
+    std::size_t result = 0;
+    apply([&](stream& s) { result = s.push_opus_buffers(packets, count); }, [&] {
+        if (failed) return;
+        for (std::size_t i = 0; i < count; ++i) {
+            const auto* data = static_cast<const std::uint8_t*>(packets[i].data);
+            auto&       kept = next_kept_buffer();
+            kept.data.assign(data, data + packets[i].size);
+            kept.pcm = false;
+            kept.capture_time_us = packets[i].capture_time_us;
+        }
+        result = count;
+    });
+    return result;
+}
+
+bool kvoice::deferred_stream::push_pcm_buffer(const void* samples, std::size_t count, sample_format format,
+                                              std::uint32_t rate) {
+    bool result = false;
+    apply([&](stream& s) { result = s.push_pcm_buffer(samples, count, format, rate); }, [&] {
+        if (failed) return;
+        const auto* data = static_cast<const std::uint8_t*>(samples);
+        const auto  size = count * (format == sample_format::int16 ? sizeof(std::int16_t) : sizeof(float));
+        auto&       kept = next_kept_buffer();
+        kept.data.assign(data, data + size);
+        kept.pcm = true;
+        kept.format = format;
+        kept.sample_rate = rate;
+        kept.capture_time_us = 0;
+        result = true;
+    });
+    return result;
+}
+
+// the real stream reads its spatial parameters from the same row, so they go to the table either way
+
+void kvoice::deferred_stream::set_position(vector pos) {
+    owner->get_spatial_table().set_position(spatial_id, pos);
+}
+
+void kvoice::deferred_stream::set_velocity(vector vel) {
+    owner->get_spatial_table().set_velocity(spatial_id, vel);
+}
+
+void kvoice::deferred_stream::set_direction(vector dir) {
+    owner->get_spatial_table().set_direction(spatial_id, dir);
+}
+
+void kvoice::deferred_stream::set_min_distance(float distance) {
+    owner->get_spatial_table().set_min_distance(spatial_id, distance);
+}
+
+void kvoice::deferred_stream::set_max_distance(float distance) {
+    owner->get_spatial_table().set_max_distance(spatial_id, distance);
+}
+
+void kvoice::deferred_stream::set_rolloff_factor(float rolloff) {
+    owner->get_spatial_table().set_rolloff_factor(spatial_id, rolloff);
+}
+
+void kvoice::deferred_stream::set_spatial_state(bool spatial_state) {
+    apply([spatial_state](stream& s) { s.set_spatial_state(spatial_state); },
+          [&] { kept_settings.spatial_state = spatial_state; });
+}
+
+void kvoice::deferred_stream::set_gain(float gain) {
+    apply([gain](stream& s) { s.set_gain(gain); }, [&] { kept_settings.gain = gain; });
+}
+
+void kvoice::deferred_stream::set_gain_group(gain_group* group) {
+    apply([group](stream& s) { s.set_gain_group(group); }, [&] { kept_settings.group = group; });
+}
+
+void kvoice::deferred_stream::set_max_latency(std::uint32_t max_latency_ms, overflow_policy policy) {
+    apply([=](stream& s) { s.set_max_latency(max_latency_ms, policy); },
+          [&] { kept_settings.max_latency = std::make_pair(max_latency_ms, policy); });
+}
+
+bool kvoice::deferred_stream::is_playing() {
+    bool result = false;
+    apply([&](stream& s) { result = s.is_playing(); }, [] {});
+    return result;
+}
+
+bool kvoice::deferred_stream::update() {
+    bool result = true;
+    apply([&](stream& s) { result = s.update(); }, [&] { result = !failed; });
+    return result;
+}
+
+kvoice::stream_stats kvoice::deferred_stream::get_stats() const {
+    if (const auto* s = ready_stream.load(std::memory_order_acquire)) return s->get_stats();
+
+    std::unique_lock lck(stream_mutex);
+    return inner ? inner->get_stats() : stream_stats{};
+}
+
+void kvoice::deferred_stream::set_packet_log(packet_log_writer* writer, std::uint32_t stream_id) {
+    apply([=](stream& s) { s.set_packet_log(writer, stream_id); },
+          [&] { kept_settings.packet_log = std::make_pair(writer, stream_id); });
+}
+
+std::uint32_t kvoice::deferred_stream::get_id() const {
+    return spatial_id;
+}
+
+void kvoice::deferred_stream::attach(sound_output_impl& output) {
+    std::unique_lock lck(stream_mutex);
+
+    try {
+        inner = output.create_stream(sample_rate, spatial_id);
+    } catch (voice_exception&) {
+        kept_packets.clear();
+        failed = true;
+        return;
+    }
+
+    const auto& k = kept_settings;
+    if (k.spatial_state) inner->set_spatial_state(*k.spatial_state);
+    if (k.gain) inner->set_gain(*k.gain);
+    if (k.group) inner->set_gain_group(*k.group);
+    if (k.max_latency) inner->set_max_latency(k.max_latency->first, k.max_latency->second);
+    if (k.packet_log) inner->set_packet_log(k.packet_log->first, k.packet_log->second);
+
+    for (const auto& kept : kept_packets) {
+        if (!kept.pcm) {
+            const opus_packet packet{ kept.data.data(), kept.data.size(), kept.capture_time_us };
+            inner->push_opus_buffers(&packet, 1);
+            continue;
+        }
+        const auto sample_size = kept.format == sample_format::int16 ? sizeof(std::int16_t) : sizeof(float);
+        inner->push_pcm_buffer(kept.data.data(), kept.data.size() / sample_size, kept.format, kept.sample_rate);
+    }
+    kept_packets.clear();
+
+    ready_stream.store(inner.get(), std::memory_order_release);
+}
+
+void kvoice::deferred_stream::fail() {
+    std::unique_lock lck(stream_mutex);
+    kept_packets.clear();
+    failed = true;
+}
+
+kvoice::async_sound_output::async_sound_output(const sound_output_config&       config,
+                                               std::function<on_device_ready_t> on_ready)
+    : device_name(config.device_name),
+      config(config),
+      resource(resource_or_default(config.memory_resource)),
+      on_device_ready(std::move(on_ready)),
+      spatial(resource),
+      pending_streams(resource) {
+    // config name is a view of caller's string
+    this->config.device_name = device_name;
+    open_thread = std::thread(&async_sound_output::open_device, this);
+}
+
+kvoice::async_sound_output::~async_sound_output() {
+    open_thread.join();
+}
+
+template <typename Func, typename Keep>
+void kvoice::async_sound_output::apply(Func&& func, Keep&& keep) {
+    if (auto* output = ready_output.load(std::memory_order_acquire)) return func(*output);
+
+    std::unique_lock lck(output_mutex);
+    if (impl) func(*impl);
+    else keep();
+}
+
+void kvoice::async_sound_output::set_my_position(vector pos) {
+    apply([pos](sound_output_impl& o) { o.set_my_position(pos); }, [&] { listener_pos = pos; });
+}
+
+void kvoice::async_sound_output::set_my_velocity(vector vel) {
+    apply([vel](sound_output_impl& o) { o.set_my_velocity(vel); }, [&] { listener_vel = vel; });
+}
+
+void kvoice::async_sound_output::set_my_orientation_up(vector up) {
+    apply([up](sound_output_impl& o) { o.set_my_orientation_up(up); }, [&] { listener_up = up; });
+}
+
+void kvoice::async_sound_output::set_my_orientation_front(vector front) {
+    apply([front](sound_output_impl& o) { o.set_my_orientation_front(front); }, [&] { listener_front = front; });
+}
+
+void kvoice::async_sound_output::update_me() {
+    apply([](sound_output_impl& o) { o.update_me(); }, [&] { listener_updated = true; });
+}
+
+void kvoice::async_sound_output::set_gain(float gain) {
+    apply([gain](sound_output_impl& o) { o.set_gain(gain); }, [&] { output_gain = gain; });
+}
+
+void kvoice::async_sound_output::change_device(std::string_view name) {
+    std::unique_lock lck(output_mutex);
+    state_cv.wait(lck, [this] { return impl || failed; });
+
+    if (!impl) throw voice_exception::create_formatted("Output device isn't open: {}", error_msg);
+    impl->change_device(name);
+}
+
+void kvoice::async_sound_output::set_buffering_time(std::uint32_t time_ms) {
+    apply([time_ms](sound_output_impl& o) { o.set_buffering_time(time_ms); },
+          [&] { min_buffering_time = time_ms; });
+}
+
+void kvoice::async_sound_output::set_buffering_bounds(std::uint32_t min_ms, std::uint32_t max_ms) {
+    apply([=](sound_output_impl& o) { o.set_buffering_bounds(min_ms, max_ms); }, [&] {
+        min_buffering_time = min_ms;
+        max_buffering_time = max_ms;
+    });
+}
+
+std::unique_ptr<kvoice::stream> kvoice::async_sound_output::create_stream() {
+    return create_stream(config.sample_rate);
+}
+
+std::unique_ptr<kvoice::stream> kvoice::async_sound_output::create_stream(std::uint32_t sample_rate) {
+    if (auto* output = ready_output.load(std::memory_order_acquire)) return output->create_stream(sample_rate);
+
+    std::unique_lock lck(output_mutex);
+    if (impl) return impl->create_stream(sample_rate);
+
+    std::unique_ptr<deferred_stream> result{ new (resource) deferred_stream(this, sample_rate, resource) };
+    if (failed) result->fail();
+    else pending_streams.push_back(result.get());
+    return result;
+}
+
+std::unique_ptr<kvoice::gain_group> kvoice::async_sound_output::create_gain_group() {
+    // groups don't touch the device, streams created before and after it is open share them
+    return std::unique_ptr<gain_group>(new (resource) gain_group_impl(nullptr, gain_generation));
+}
+
+std::unique_ptr<kvoice::gain_group> kvoice::async_sound_output::create_gain_group(gain_group& parent) {
+    return std::unique_ptr<gain_group>(
+        new (resource) gain_group_impl(static_cast<gain_group_impl*>(&parent), gain_generation));
+}
+
+// the table is shared with the open device, so bulk updates skip the ready check
+void kvoice::async_sound_output::set_positions(const std::uint32_t* ids, const float* xs, const float* ys,
+                                               const float* zs, std::size_t count) {
+    spatial.set_positions(ids, xs, ys, zs, count);
+}
+
+void kvoice::async_sound_output::set_velocities(const std::uint32_t* ids, const float* xs, const float* ys,
+                                                const float* zs, std::size_t count) {
+    spatial.set_velocities(ids, xs, ys, zs, count);
+}
+
+void kvoice::async_sound_output::set_directions(const std::uint32_t* ids, const float* xs, const float* ys,
+                                                const float* zs, std::size_t count) {
+    spatial.set_directions(ids, xs, ys, zs, count);
+}
+
+void kvoice::async_sound_output::set_distances(const std::uint32_t* ids, const float* min_distances,
+                                               const float* max_distances, const float* rolloff_factors,
+                                               std::size_t count) {
+    spatial.set_distances(ids, min_distances, max_distances, rolloff_factors, count);
+}
+
+void kvoice::async_sound_output::unregister_stream(deferred_stream* s) {
+    std::unique_lock lck(output_mutex);
+    pending_streams.erase(std::remove(pending_streams.begin(), pending_streams.end(), s), pending_streams.end());
+}
+
+void kvoice::async_sound_output::open_device() {
+    std::unique_ptr<sound_output_impl> output;
+    std::string                        error;
+    try {
+        output.reset(new (resource) sound_output_impl(config.device_name, config.sample_rate, config.src_count,
+                                                      config.format, config.lock_memory, config.hibernate_after_ms,
+                                                      config.hibernate_pool_size, config.profile,
+                                                      config.refresh_rate, resource, &spatial));
+    } catch (voice_exception& e) {
+        error = e.what();
+    }
+
+    {
+        std::unique_lock lck(output_mutex);
+        if (output) {
+            output->set_my_position(listener_pos);
+            output->set_my_velocity(listener_vel);
+            output->set_my_orientation_up(listener_up);
+            output->set_my_orientation_front(listener_front);
+            if (listener_updated) output->update_me();
+            if (output_gain) output->set_gain(*output_gain);
+            if (min_buffering_time || max_buffering_time) {
+                output->set_buffering_bounds(min_buffering_time.value_or(output->get_min_buffering_time()),
+                                             max_buffering_time.value_or(output->get_max_buffering_time()));
+            }
+
+            for (auto* s : pending_streams) s->attach(*output);
+
+            impl = std::move(output);
+            ready_output.store(impl.get(), std::memory_order_release);
+        } else {
+            for (auto* s : pending_streams) s->fail();
+
+            failed = true;
+            error_msg = error;
+        }
+        pending_streams.clear();
+    }
+    state_cv.notify_all();
+
+    if (on_device_ready) on_device_ready(error.empty(), error);
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kvoice.hpp"
+#include "resource_allocated.hpp"
+#include "spatial_table.hpp"
+
+namespace kvoice {
+class sound_output_impl;
+class async_sound_output;
+
+/**
+ * @brief stream created before its output device is open
+ * @details settings and packets are kept until the device is open, then the real stream is created and
+ * everything is forwarded to it
+ */
+class deferred_stream final : public stream, public resource_allocated {
+    // about a second of 20 ms packets, the oldest packets are dropped first
+    static constexpr auto kMaxDeferredPackets = 64;
+
+    // opus packet or pcm block pushed before the device is open
+    struct kept_buffer {
+        explicit kept_buffer(std::pmr::memory_resource* resource) : data(resource) {}
+
+        std::pmr::vector<std::uint8_t> data;
+        bool                           pcm{ false };
+        sample_format                  format{ sample_format::float32 };
+        std::uint32_t                  sample_rate{ 0 };
+        std::uint64_t                  capture_time_us{ 0 };
+    };
+
+public:
+    /**
+     * @brief Constructor
+     * @param output owning output, the stream takes a row of its spatial table
+     * @param sample_rate opus decoder sampling rate
+     * @param resource resource of kept packets
+     */
+    deferred_stream(async_sound_output* output, std::uint32_t sample_rate, std::pmr::memory_resource* resource);
+    ~deferred_stream() override;
+
+    bool        push_opus_buffer(const void* data, std::size_t count) override;
+    std::size_t push_opus_buffers(const opus_packet* packets, std::size_t count) override;
+    bool        push_pcm_buffer(const void* samples, std::size_t count, sample_format format,
+                                std::uint32_t sample_rate) override;
+
+    void set_position(vector pos) override;
+    void set_velocity(vector vel) override;
+    void set_direction(vector dir) override;
+    void set_min_distance(float distance) override;
+    void set_max_distance(float distance) override;
+    void set_rolloff_factor(float rolloff) override;
+    void set_spatial_state(bool spatial_state) override;
+    void set_gain(float gain) override;
+    void set_gain_group(gain_group* group) override;
+    void set_max_latency(std::uint32_t max_latency_ms, overflow_policy policy) override;
+
+    bool is_playing() override;
+
+    bool update() override;
+
+    [[nodiscard]] stream_stats get_stats() const override;
+
+    void set_packet_log(packet_log_writer* writer, std::uint32_t stream_id) override;
+
+    [[nodiscard]] std::uint32_t get_id() const override;
+
+    /**
+     * @brief creates the real stream on open device, applies kept settings and pushes kept packets
+     * @param output open device
+     */
+    void attach(sound_output_impl& output);
+
+    /**
+     * @brief drops kept packets, stream stays silent
+     */
+    void fail();
+
+private:
+    // spatial parameters are kept in the spatial table of the owner
+    struct settings {
+        std::optional<bool>                                     spatial_state;
+        std::optional<float>                                    gain;
+        std::optional<gain_group*>                              group;
+        std::optional<std::pair<std::uint32_t, overflow_policy>> max_latency;
+        std::optional<std::pair<packet_log_writer*, std::uint32_t>> packet_log;
+    };
+
+    /**
+     * @brief calls @p func on the real stream if it exists, else calls @p keep under the lock
+     */
+    template <typename Func, typename Keep>
+    void apply(Func&& func, Keep&& keep);
+
+    /**
+     * @brief gets buffer for a packet to keep, reuses the oldest one if @p kMaxDeferredPackets are kept
+     */
+    kept_buffer& next_kept_buffer();
+
+    async_sound_output*        owner{ nullptr };
+    std::uint32_t              sample_rate{ 0 };
+    std::uint32_t              spatial_id{ spatial_table::kNoId };
+    std::pmr::memory_resource* resource{ nullptr };
+
+    mutable std::mutex           stream_mutex;
+    std::unique_ptr<stream>      inner{};
+    std::atomic<stream*>         ready_stream{ nullptr };
+    settings                     kept_settings{};
+    std::pmr::deque<kept_buffer> kept_packets;
+    bool                         failed{ false };
+};
+
+/**
+ * @brief output that opens its device on a background thread
+ * @details calls made before the device is open are kept and applied once it is, after that every call is
+ * forwarded to the open device with a single atomic load of overhead
+ */
+class async_sound_output final : public sound_output, public resource_allocated {
+public:
+    /**
+     * @brief Constructor, starts opening the device
+     * @param config output device parameters, the output and its deferred streams are allocated from its resource
+     * @param on_ready callback called on the background thread once device is open or failed to open
+     */
+    async_sound_output(const sound_output_config& config, std::function<on_device_ready_t> on_ready);
+    ~async_sound_output() override;
+
+    void set_my_position(vector pos) override;
+    void set_my_velocity(vector vel) override;
+    void set_my_orientation_up(vector up) override;
+    void set_my_orientation_front(vector front) override;
+    void update_me() override;
+    void set_gain(float gain) override;
+    /**
+     * @brief changes output device, waits for the first device to open if it isn't yet
+     * @throws voice_exception if device couldn't be open
+     */
+    void change_device(std::string_view device_name) override;
+    void set_buffering_time(std::uint32_t time_ms) override;
+    void set_buffering_bounds(std::uint32_t min_ms, std::uint32_t max_ms) override;
+
+    std::unique_ptr<stream> create_stream() override;
+    std::unique_ptr<stream> create_stream(std::uint32_t sample_rate) override;
+
+    std::unique_ptr<gain_group> create_gain_group() override;
+    std::unique_ptr<gain_group> create_gain_group(gain_group& parent) override;
+
+    void set_positions(const std::uint32_t* ids, const float* xs, const float* ys, const float* zs,
+                       std::size_t count) override;
+    void set_velocities(const std::uint32_t* ids, const float* xs, const float* ys, const float* zs,
+                        std::size_t count) override;
+    void set_directions(const std::uint32_t* ids, const float* xs, const float* ys, const float* zs,
+                        std::size_t count) override;
+    void set_distances(const std::uint32_t* ids, const float* min_distances, const float* max_distances,
+                       const float* rolloff_factors, std::size_t count) override;
+
+    /**
+     * @brief forgets stream destroyed before the device is open
+     */
+    void unregister_stream(deferred_stream* s);
+
+    /**
+     * @brief spatial table shared with the open device, rows of deferred streams are kept by the real ones
+     */
+    [[nodiscard]] spatial_table& get_spatial_table() { return spatial; }
+
+private:
+    void open_device();
+
+    /**
+     * @brief calls @p func on the open device if it exists, else calls @p keep under the lock
+     */
+    template <typename Func, typename Keep>
+    void apply(Func&& func, Keep&& keep);
+
+    std::string                      device_name;
+    sound_output_config              config;
+    std::pmr::memory_resource*       resource{ nullptr };
+    std::function<on_device_ready_t> on_device_ready;
+
+    // outlives the open device, it refers to the table
+    spatial_table spatial;
+
+    mutable std::mutex                 output_mutex;
+    std::condition_variable            state_cv;
+    std::unique_ptr<sound_output_impl> impl{};
+    std::atomic<sound_output_impl*>    ready_output{ nullptr };
+    bool                               failed{ false };
+    std::string                        error_msg{};
+
+    // bumped by every change of any gain group of this output
+    std::atomic<std::uint32_t> gain_generation{ 0 };
+
+    // kept until the device is open
+    std::pmr::vector<deferred_stream*> pending_streams;
+    vector                             listener_pos{};
+    vector                             listener_vel{};
+    vector                             listener_up{};
+    vector                             listener_front{};
+    bool                               listener_updated{ false };
+    std::optional<float>               output_gain{};
+    std::optional<std::uint32_t>       min_buffering_time{};
+    std::optional<std::uint32_t>       max_buffering_time{};
+
+    std::thread open_thread;
+};
+}
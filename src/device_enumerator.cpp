@@ -0,0 +1,152 @@
+#include "device_enumerator.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#include <AL/alc.h>
+#include <AL/alext.h>
+
+#include "kvoice.hpp"
+
+namespace {
+std::string get_default_device(ALCenum param) {
+    const char* name = alcGetString(nullptr, param);
+    return name ? name : "";
+}
+
+std::shared_ptr<kvoice::device_list> enumerate_devices() {
+    auto devices = std::make_shared<kvoice::device_list>();
+    devices->input_devices = kvoice::get_input_devices();
+    devices->output_devices = kvoice::get_output_devices();
+    devices->default_input = get_default_device(ALC_CAPTURE_DEFAULT_DEVICE_SPECIFIER);
+    devices->default_output = get_default_device(alcIsExtensionPresent(nullptr, "ALC_enumerate_all_EXT")
+                                                     ? ALC_DEFAULT_ALL_DEVICES_SPECIFIER
+                                                     : ALC_DEFAULT_DEVICE_SPECIFIER);
+    return devices;
+}
+
+bool same_devices(const kvoice::device_list& lhs, const kvoice::device_list& rhs) {
+    return lhs.input_devices == rhs.input_devices && lhs.output_devices == rhs.output_devices &&
+           lhs.default_input == rhs.default_input && lhs.default_output == rhs.default_output;
+}
+
+void notify_changes(const std::function<kvoice::on_device_change_t>& cb, kvoice::device_type type,
+                    const std::vector<std::string>& old_list, const std::vector<std::string>& new_list,
+                    const std::string& old_default, const std::string& new_default) {
+    for (const auto& name : new_list) {
+        if (std::find(old_list.begin(), old_list.end(), name) == old_list.end())
+            cb(type, kvoice::device_change::added, name);
+    }
+    for (const auto& name : old_list) {
+        if (std::find(new_list.begin(), new_list.end(), name) == new_list.end())
+            cb(type, kvoice::device_change::removed, name);
+    }
+    if (old_default != new_default) cb(type, kvoice::device_change::default_changed, new_default);
+}
+
+#ifdef ALC_SOFT_system_events
+void ALC_APIENTRY on_system_event(ALCenum, ALCenum, ALCdevice*, ALCsizei, const ALCchar*, void* user) noexcept {
+    static_cast<kvoice::device_enumerator*>(user)->refresh();
+}
+
+constexpr ALCenum kSystemEvents[] = {
+    ALC_EVENT_TYPE_DEFAULT_DEVICE_CHANGED_SOFT,
+    ALC_EVENT_TYPE_DEVICE_ADDED_SOFT,
+    ALC_EVENT_TYPE_DEVICE_REMOVED_SOFT,
+};
+#endif
+}
+
+kvoice::device_enumerator::device_enumerator(std::chrono::milliseconds poll_interval)
+    : snapshot(std::make_shared<device_list>()),
+      interval(poll_interval) {
+#ifdef ALC_SOFT_system_events
+    if (alcIsExtensionPresent(nullptr, "ALC_SOFT_system_events")) {
+        const auto event_control = reinterpret_cast<LPALCEVENTCONTROLSOFT>(
+            alcGetProcAddress(nullptr, "alcEventControlSOFT"));
+        const auto event_callback = reinterpret_cast<LPALCEVENTCALLBACKSOFT>(
+            alcGetProcAddress(nullptr, "alcEventCallbackSOFT"));
+
+        if (event_control && event_callback) {
+            event_callback(&on_system_event, this);
+            system_events = event_control(static_cast<ALCsizei>(std::size(kSystemEvents)), kSystemEvents, ALC_TRUE);
+            if (!system_events) event_callback(nullptr, nullptr);
+        }
+    }
+#endif
+    enumerator_thread = std::thread(&device_enumerator::process, this);
+}
+
+kvoice::device_enumerator::~device_enumerator() {
+#ifdef ALC_SOFT_system_events
+    // OpenAL serializes the event delivery with callback change, so no event is in flight after this
+    if (system_events) {
+        const auto event_control = reinterpret_cast<LPALCEVENTCONTROLSOFT>(
+            alcGetProcAddress(nullptr, "alcEventControlSOFT"));
+        const auto event_callback = reinterpret_cast<LPALCEVENTCALLBACKSOFT>(
+            alcGetProcAddress(nullptr, "alcEventCallbackSOFT"));
+        event_control(static_cast<ALCsizei>(std::size(kSystemEvents)), kSystemEvents, ALC_FALSE);
+        event_callback(nullptr, nullptr);
+    }
+#endif
+    {
+        std::unique_lock lck(enumerator_mutex);
+        alive = false;
+    }
+    refresh_cv.notify_one();
+    enumerator_thread.join();
+}
+
+std::shared_ptr<const kvoice::device_list> kvoice::device_enumerator::get_devices() const {
+    std::unique_lock lck(enumerator_mutex);
+    return snapshot;
+}
+
+void kvoice::device_enumerator::set_change_callback(std::function<on_device_change_t> cb) {
+    std::unique_lock lck(enumerator_mutex);
+    on_change = std::move(cb);
+}
+
+void kvoice::device_enumerator::refresh() {
+    {
+        std::unique_lock lck(enumerator_mutex);
+        refresh_requested = true;
+    }
+    refresh_cv.notify_one();
+}
+
+void kvoice::device_enumerator::process() {
+    std::unique_lock lck(enumerator_mutex);
+    while (alive) {
+        refresh_requested = false;
+
+        // enumeration may take hundreds of ms, readers keep getting the previous snapshot meanwhile
+        lck.unlock();
+        publish(enumerate_devices());
+        lck.lock();
+
+        refresh_cv.wait_for(lck, interval, [this] { return !alive || refresh_requested; });
+    }
+}
+
+void kvoice::device_enumerator::publish(std::shared_ptr<device_list> devices) {
+    std::shared_ptr<const device_list> previous;
+    std::function<on_device_change_t>  cb;
+    {
+        std::unique_lock lck(enumerator_mutex);
+        if (snapshot->generation != 0 && same_devices(*snapshot, *devices)) return;
+
+        devices->generation = snapshot->generation + 1;
+        previous = std::exchange(snapshot, devices);
+        cb = on_change;
+    }
+
+    // the first enumeration is a baseline, not a change
+    if (!cb || previous->generation == 0) return;
+
+    notify_changes(cb, device_type::input, previous->input_devices, devices->input_devices, previous->default_input,
+                   devices->default_input);
+    notify_changes(cb, device_type::output, previous->output_devices, devices->output_devices,
+                   previous->default_output, devices->default_output);
+}
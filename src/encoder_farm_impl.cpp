@@ -0,0 +1,297 @@
+#include "encoder_farm_impl.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "sample_traits.hpp"
+#include "thread_utils.hpp"
+#include "tracing.hpp"
+
+template <typename SampleT>
+kvoice::encoder_source_impl<SampleT>::encoder_source_impl(encoder_farm_impl*              farm,
+                                                          const encoder_source_config&    config,
+                                                          std::function<on_voice_input_t> cb)
+    : owner(farm),
+      frame_coder(static_cast<std::int32_t>(config.sample_rate), config.bitrate, config.packet_duration_ms,
+                  resolve_frame_size(static_cast<std::int32_t>(config.sample_rate), config.frame_size, config.profile),
+                  config.profile, farm->get_memory_resource()),
+      on_voice_input(std::move(cb)),
+      max_queued_samples(static_cast<std::size_t>(config.max_queued_ms) * config.sample_rate / 1000),
+      blocks(farm->get_memory_resource()),
+      spare_blocks(farm->get_memory_resource()),
+      partial_frame(farm->get_memory_resource()) {
+    partial_frame.reserve(frame_coder.get_frame_size());
+    blocks.reserve(kMaxSpareBlocks);
+    spare_blocks.reserve(kMaxSpareBlocks);
+}
+
+template <typename SampleT>
+kvoice::encoder_source_impl<SampleT>::~encoder_source_impl() {
+    std::unique_lock lck(source_mutex);
+    closing = true;
+    // a scheduled source is still referenced by the run queue or by a worker
+    idle_cv.wait(lck, [this] { return !scheduled; });
+}
+
+template <typename SampleT>
+bool kvoice::encoder_source_impl<SampleT>::push_pcm(const void* samples, std::size_t count) {
+    if (count == 0) return true;
+
+    const auto* first = static_cast<const SampleT*>(samples);
+    bool        schedule_needed;
+    {
+        std::unique_lock lck(source_mutex);
+        if (queued_samples + count > max_queued_samples) {
+            stats.rejected_blocks.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        if (spare_blocks.empty()) {
+            // queue is deeper than ever before, spares are provisioned up to the cap at once so a later burst of
+            // pushes doesn't allocate a block each
+            while (spare_blocks.size() < kMaxSpareBlocks) spare_blocks.emplace_back().reserve(count);
+        }
+        auto block = std::move(spare_blocks.back());
+        spare_blocks.pop_back();
+        block.assign(first, first + count);
+        blocks.push_back(std::move(block));
+
+        queued_samples += count;
+        stats.queued_samples.store(static_cast<std::uint32_t>(queued_samples), std::memory_order_relaxed);
+        schedule_needed = !std::exchange(scheduled, true);
+    }
+    stats.pushed_samples.fetch_add(count, std::memory_order_relaxed);
+
+    if (schedule_needed) owner->schedule(this);
+    return true;
+}
+
+template <typename SampleT>
+void kvoice::encoder_source_impl<SampleT>::set_gain(float gain) {
+    input_gain.store(gain);
+}
+
+template <typename SampleT>
+void kvoice::encoder_source_impl<SampleT>::flush() {
+    std::unique_lock lck(source_mutex);
+    idle_cv.wait(lck, [this] { return !scheduled; });
+}
+
+template <typename SampleT>
+kvoice::input_stats kvoice::encoder_source_impl<SampleT>::get_stats() const {
+    input_stats result;
+
+    const auto encoded = stats.encoded_packets.load(std::memory_order_relaxed);
+
+    result.captured_samples = stats.pushed_samples.load(std::memory_order_relaxed);
+    result.capture_backlog = stats.queued_samples.load(std::memory_order_relaxed);
+    result.overruns = stats.rejected_blocks.load(std::memory_order_relaxed);
+    result.encoded_packets = encoded;
+    result.dropped_packets = stats.dropped_packets.load(std::memory_order_relaxed);
+    if (encoded > 0) {
+        result.avg_encode_time_us = static_cast<float>(stats.encode_time_ns.load(std::memory_order_relaxed)) /
+                                    static_cast<float>(encoded) / 1000.f;
+    }
+    return result;
+}
+
+template <typename SampleT>
+bool kvoice::encoder_source_impl<SampleT>::run(std::uint8_t* packet) {
+    std::pmr::vector<SampleT> block(owner->get_memory_resource());
+    {
+        std::unique_lock lck(source_mutex);
+        if (closing || first_block == blocks.size()) {
+            scheduled = false;
+            idle_cv.notify_all();
+            return false;
+        }
+        block = take_block();
+    }
+
+    for (auto i = 0;; ++i) {
+        encode_block(block, packet);
+
+        std::unique_lock lck(source_mutex);
+        queued_samples -= block.size();
+        stats.queued_samples.store(static_cast<std::uint32_t>(queued_samples), std::memory_order_relaxed);
+        if (spare_blocks.size() < kMaxSpareBlocks) spare_blocks.push_back(std::move(block));
+
+        if (closing || first_block == blocks.size()) {
+            // the source may be destroyed as soon as the lock is released
+            scheduled = false;
+            idle_cv.notify_all();
+            return false;
+        }
+        if (i + 1 == kBlocksPerRun) return true;
+
+        block = take_block();
+    }
+}
+
+template <typename SampleT>
+std::pmr::vector<SampleT> kvoice::encoder_source_impl<SampleT>::take_block() {
+    auto block = std::move(blocks[first_block++]);
+
+    // moved-from vectors own no memory, erasing them only shifts the queued ones
+    if (first_block == blocks.size()) {
+        blocks.clear();
+        first_block = 0;
+    } else if (first_block * 2 >= blocks.size()) {
+        blocks.erase(blocks.begin(), blocks.begin() + static_cast<std::ptrdiff_t>(first_block));
+        first_block = 0;
+    }
+    return block;
+}
+
+template <typename SampleT>
+void kvoice::encoder_source_impl<SampleT>::encode_block(std::pmr::vector<SampleT>& block, std::uint8_t* packet) {
+    std::transform(block.begin(), block.end(), block.begin(),
+                   [gain = input_gain.load()](const SampleT v) { return apply_gain(v, gain); });
+
+    const auto     frame_size = static_cast<std::size_t>(frame_coder.get_frame_size());
+    const SampleT* data = block.data();
+    std::size_t    remaining = block.size();
+
+    // complete the frame left from the previous block
+    if (!partial_frame.empty()) {
+        const auto needed = std::min(remaining, frame_size - partial_frame.size());
+        partial_frame.insert(partial_frame.end(), data, data + needed);
+        data += needed;
+        remaining -= needed;
+
+        if (partial_frame.size() < frame_size) return;
+        encode_frame(partial_frame.data(), packet);
+        partial_frame.clear();
+    }
+
+    for (; remaining >= frame_size; remaining -= frame_size, data += frame_size)
+        encode_frame(data, packet);
+
+    partial_frame.insert(partial_frame.end(), data, data + remaining);
+}
+
+template <typename SampleT>
+void kvoice::encoder_source_impl<SampleT>::encode_frame(const SampleT* frame, std::uint8_t* packet) {
+    const auto encode_start = std::chrono::steady_clock::now();
+    int        len;
+    {
+        KVOICE_TRACE_SCOPE(opus_encode);
+        len = frame_coder.encode(frame, packet, kPacketMaxSize);
+    }
+    if (len < 0) {
+        stats.dropped_packets.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    stats.encode_time_ns.fetch_add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - encode_start).count(),
+        std::memory_order_relaxed);
+
+    // frame staged until the packet is complete
+    if (len == 0) return;
+
+    stats.encoded_packets.fetch_add(1, std::memory_order_relaxed);
+    if (on_voice_input) {
+        KVOICE_TRACE_SCOPE(input_callback);
+        on_voice_input(packet, static_cast<std::size_t>(len));
+    }
+}
+
+template class kvoice::encoder_source_impl<float>;
+template class kvoice::encoder_source_impl<std::int16_t>;
+
+kvoice::encoder_farm_impl::encoder_farm_impl(const encoder_farm_config& config)
+    : thread_name(config.worker_thread.name),
+      thread_settings(config.worker_thread),
+      resource(resource_or_default(config.memory_resource)) {
+    // config name is a view of caller's string, keep own copy for the threads
+    thread_settings.name = thread_name;
+
+    auto count = config.worker_count != 0 ? config.worker_count : std::thread::hardware_concurrency();
+    if (count == 0) count = 1;
+
+    reports.resize(count);
+    workers.reserve(count);
+    for (auto i = 0u; i < count; ++i) workers.emplace_back(&encoder_farm_impl::process_worker, this, i);
+}
+
+kvoice::encoder_farm_impl::~encoder_farm_impl() {
+    {
+        std::unique_lock lck(farm_mutex);
+        alive = false;
+    }
+    work_cv.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+std::unique_ptr<kvoice::encoder_source> kvoice::encoder_farm_impl::create_source(
+    const encoder_source_config& config, std::function<on_voice_input_t> cb) {
+    if (config.format == sample_format::int16)
+        return std::unique_ptr<encoder_source>(new (resource) encoder_source_impl<std::int16_t>(this, config,
+                                                                                                std::move(cb)));
+    return std::unique_ptr<encoder_source>(new (resource) encoder_source_impl<float>(this, config, std::move(cb)));
+}
+
+std::uint32_t kvoice::encoder_farm_impl::get_worker_count() const {
+    return static_cast<std::uint32_t>(workers.size());
+}
+
+std::vector<kvoice::thread_report> kvoice::encoder_farm_impl::get_thread_reports() const {
+    std::unique_lock lck(farm_mutex);
+    return reports;
+}
+
+void kvoice::encoder_farm_impl::schedule(encoder_source_base* source) {
+    {
+        std::unique_lock lck(farm_mutex);
+        push_run(source);
+    }
+    work_cv.notify_one();
+}
+
+void kvoice::encoder_farm_impl::push_run(encoder_source_base* source) {
+    source->next_scheduled = nullptr;
+    if (run_tail)
+        run_tail->next_scheduled = source;
+    else
+        run_head = source;
+    run_tail = source;
+}
+
+kvoice::encoder_source_base* kvoice::encoder_farm_impl::pop_run() {
+    auto* source = run_head;
+    run_head = source->next_scheduled;
+    if (!run_head) run_tail = nullptr;
+    return source;
+}
+
+void kvoice::encoder_farm_impl::process_worker(std::size_t index) {
+    std::array<std::uint8_t, kPacketMaxSize> packet{};
+
+    auto report = apply_thread_config(thread_settings, "kvoice-encoder");
+    if (thread_settings.lock_memory) {
+        report.memory_locked = lock_memory(packet.data(), packet.size());
+        if (!report.memory_locked) report.errors += report.errors.empty() ? "couldn't lock memory"
+                                                                          : "; couldn't lock memory";
+    }
+
+    std::unique_lock lck(farm_mutex);
+    reports[index] = std::move(report);
+
+    while (true) {
+        // queued sources are drained before the workers exit
+        work_cv.wait(lck, [this] { return !alive || run_head; });
+        if (!run_head) break;
+
+        auto* source = pop_run();
+
+        lck.unlock();
+        const bool more = source->run(packet.data());
+        lck.lock();
+
+        if (more) push_run(source);
+    }
+    lck.unlock();
+
+    if (thread_settings.lock_memory) unlock_memory(packet.data(), packet.size());
+}
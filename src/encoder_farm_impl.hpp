@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder_farm.hpp"
+#include "frame_encoder.hpp"
+#include "resource_allocated.hpp"
+
+namespace kvoice {
+class encoder_farm_impl;
+
+/**
+ * @brief part of encoder source seen by the workers
+ */
+class encoder_source_base : public encoder_source {
+public:
+    /**
+     * @brief encodes a few queued blocks
+     * @param packet worker scratch buffer of @p kPacketMaxSize bytes
+     * @return true if blocks are left and the source should be queued again
+     */
+    virtual bool run(std::uint8_t* packet) = 0;
+
+    /**
+     * @brief next source in the run queue, touched only under the farm lock
+     */
+    encoder_source_base* next_scheduled{ nullptr };
+};
+
+template <typename SampleT>
+class encoder_source_impl final : public encoder_source_base, public resource_allocated {
+    // blocks encoded per run before the worker moves to the next source
+    static constexpr auto kBlocksPerRun = 4;
+    // block vectors kept for reuse by push_pcm
+    static constexpr auto kMaxSpareBlocks = 8;
+
+public:
+    /**
+     * @brief Constructor
+     * @param farm owning farm, its resource holds the encoder and queued blocks
+     * @param config source parameters
+     * @param cb packet callback
+     * @throws voice_exception if encoder couldn't be created
+     */
+    encoder_source_impl(encoder_farm_impl* farm, const encoder_source_config& config,
+                        std::function<on_voice_input_t> cb);
+    ~encoder_source_impl() override;
+
+    bool push_pcm(const void* samples, std::size_t count) override;
+    void set_gain(float gain) override;
+    void flush() override;
+
+    [[nodiscard]] input_stats get_stats() const override;
+
+    bool run(std::uint8_t* packet) override;
+
+private:
+    struct counters {
+        std::atomic<std::uint64_t> pushed_samples{ 0 };
+        std::atomic<std::uint32_t> queued_samples{ 0 };
+        std::atomic<std::uint64_t> rejected_blocks{ 0 };
+        std::atomic<std::uint64_t> encoded_packets{ 0 };
+        std::atomic<std::uint64_t> dropped_packets{ 0 };
+        std::atomic<std::uint64_t> encode_time_ns{ 0 };
+    };
+
+    void encode_block(std::pmr::vector<SampleT>& block, std::uint8_t* packet);
+    std::pmr::vector<SampleT> take_block();
+    void encode_frame(const SampleT* frame, std::uint8_t* packet);
+
+    encoder_farm_impl*              owner{ nullptr };
+    frame_encoder                   frame_coder;
+    std::function<on_voice_input_t> on_voice_input;
+    std::atomic<float>              input_gain{ 1.f };
+    std::size_t                     max_queued_samples{ 0 };
+
+    mutable std::mutex                           source_mutex;
+    std::condition_variable                      idle_cv;
+    // queued blocks from first_block on, the consumed prefix is dropped once it's empty or half of the vector,
+    // so vectors are reused without allocations
+    std::pmr::vector<std::pmr::vector<SampleT>> blocks;
+    std::size_t                                  first_block{ 0 };
+    std::pmr::vector<std::pmr::vector<SampleT>> spare_blocks;
+    std::size_t                                  queued_samples{ 0 };
+    // true while the source is in the run queue or is being encoded
+    bool                                         scheduled{ false };
+    bool                                         closing{ false };
+
+    // touched only by the worker that runs the source
+    std::pmr::vector<SampleT> partial_frame;
+
+    counters stats{};
+};
+
+class encoder_farm_impl final : public encoder_farm, public resource_allocated {
+public:
+    /**
+     * @brief Constructor, starts the workers
+     * @param config farm parameters, sources are allocated from its memory resource
+     */
+    explicit encoder_farm_impl(const encoder_farm_config& config);
+    ~encoder_farm_impl() override;
+
+    std::unique_ptr<encoder_source> create_source(const encoder_source_config&    config,
+                                                  std::function<on_voice_input_t> cb) override;
+
+    [[nodiscard]] std::uint32_t              get_worker_count() const override;
+    [[nodiscard]] std::vector<thread_report> get_thread_reports() const override;
+
+    /**
+     * @brief queues source for encoding
+     */
+    void schedule(encoder_source_base* source);
+
+    /**
+     * @brief resource of the sources
+     */
+    [[nodiscard]] std::pmr::memory_resource* get_memory_resource() const { return resource; }
+
+private:
+    void process_worker(std::size_t index);
+    void push_run(encoder_source_base* source);
+    encoder_source_base* pop_run();
+
+    std::string                thread_name{};
+    thread_config              thread_settings{};
+    std::pmr::memory_resource* resource{ nullptr };
+
+    mutable std::mutex                farm_mutex;
+    std::condition_variable           work_cv;
+    // intrusive list linked by next_scheduled, a source is queued at most once
+    encoder_source_base*              run_head{ nullptr };
+    encoder_source_base*              run_tail{ nullptr };
+    bool                              alive{ true };
+    std::vector<thread_report>        reports{};
+    std::vector<std::thread>          workers{};
+};
+}
@@ -0,0 +1,111 @@
+#include "frame_encoder.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <opus.h>
+
+#include "sample_traits.hpp"
+#include "voice_exception.hpp"
+
+std::int32_t kvoice::resolve_frame_size(std::int32_t sample_rate, std::uint32_t frame_size, latency_profile profile) {
+    if (frame_size == 0)
+        return profile == latency_profile::low_latency ? sample_rate / kLowLatencyFrameDivider : kOpusFrameSize;
+
+    // opus frames are 2.5, 5, 10, 20, 40 or 60 ms long, in quarters of 10 ms
+    const auto scaled = static_cast<std::int64_t>(frame_size) * 400;
+    const auto quarters = scaled / sample_rate;
+    if (scaled % sample_rate != 0 ||
+        (quarters != 1 && quarters != 2 && quarters != 4 && quarters != 8 && quarters != 16 && quarters != 24)) {
+        throw voice_exception::create_formatted("Frame of {} samples at {} Hz isn't a valid opus frame", frame_size,
+                                                sample_rate);
+    }
+    return static_cast<std::int32_t>(frame_size);
+}
+
+kvoice::frame_encoder::frame_encoder(std::int32_t sample_rate, std::uint32_t bitrate,
+                                     std::uint32_t packet_duration_ms, std::int32_t frame_size,
+                                     latency_profile profile, std::pmr::memory_resource* resource)
+    : resource(resource),
+      frame_size(frame_size),
+      frame_storage(resource) {
+    if (packet_duration_ms != 0) {
+        const auto packet_samples = static_cast<std::int64_t>(packet_duration_ms) * sample_rate / 1000;
+        if (packet_duration_ms > kMaxPacketDurationMs || packet_samples * 1000 != packet_duration_ms * sample_rate ||
+            packet_samples % frame_size != 0 || packet_samples == 0) {
+            throw voice_exception::create_formatted("Packet duration {} ms isn't a multiple of {} samples at {} Hz",
+                                                    packet_duration_ms, frame_size, sample_rate);
+        }
+        frames_per_packet = static_cast<std::int32_t>(packet_samples / frame_size);
+    }
+
+    // restricted low delay mode drops SILK, so 2.5 and 5 ms frames are encoded without the lookahead of VOIP mode
+    const int application = profile == latency_profile::low_latency ? OPUS_APPLICATION_RESTRICTED_LOWDELAY
+                                                                      : OPUS_APPLICATION_VOIP;
+    // encoder state holds no pointers, so it is initialized in place instead of opus_encoder_create
+    encoder_size = static_cast<std::size_t>(opus_encoder_get_size(1));
+    encoder = static_cast<OpusEncoder*>(resource->allocate(encoder_size, alignof(std::max_align_t)));
+
+    int opus_err = opus_encoder_init(encoder, sample_rate, 1, application);
+    if (opus_err != OPUS_OK) {
+        resource->deallocate(encoder, encoder_size, alignof(std::max_align_t));
+        throw voice_exception::create_formatted("Couldn't create opus encoder (errc = {})", opus_err);
+    }
+
+    if ((opus_err = opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate))) != OPUS_OK) {
+        resource->deallocate(encoder, encoder_size, alignof(std::max_align_t));
+        throw voice_exception::create_formatted("Couldn't set encoder bitrate (errc = {})", opus_err);
+    }
+
+    if (frames_per_packet > 1) {
+        repacketizer_size = static_cast<std::size_t>(opus_repacketizer_get_size());
+        repacketizer = opus_repacketizer_init(
+            static_cast<OpusRepacketizer*>(resource->allocate(repacketizer_size, alignof(std::max_align_t))));
+        frame_storage.resize(static_cast<std::size_t>(frames_per_packet) * kFrameMaxSize);
+    }
+}
+
+kvoice::frame_encoder::~frame_encoder() {
+    resource->deallocate(encoder, encoder_size, alignof(std::max_align_t));
+    if (repacketizer) resource->deallocate(repacketizer, repacketizer_size, alignof(std::max_align_t));
+}
+
+template <typename SampleT>
+int kvoice::frame_encoder::encode(const SampleT* frame, std::uint8_t* out, int out_size) {
+    // single frame packets are encoded straight into the output, frames of longer packets are staged
+    // until the repacketizer has all of them. Each staged frame gets its share of the output less up to 2 bytes
+    // of repacketizer framing, so the encoder lowers the bitrate instead of building a packet that can't fit
+    const bool    staged = frames_per_packet > 1;
+    std::uint8_t* frame_out = staged ? &frame_storage[static_cast<std::size_t>(staged_frames) * kFrameMaxSize] : out;
+    const int     frame_out_size = staged
+                                       ? std::min(kFrameMaxSize, (out_size - 2 * frames_per_packet) / frames_per_packet)
+                                       : out_size;
+
+    int len = sample_traits<SampleT>::encode(encoder, frame, frame_size, frame_out, frame_out_size);
+    if (len < 0 || len > frame_out_size) return -1;
+    if (!staged) return len;
+
+    if (opus_repacketizer_cat(repacketizer, frame_out, len) != OPUS_OK) {
+        // encoder switched mode, bandwidth or channels, frames of different configurations can't share a packet
+        if (staged_frames == 0) return -1;
+        return split_packet(frame_out, len, out, out_size);
+    }
+    if (++staged_frames < frames_per_packet) return 0;
+
+    staged_frames = 0;
+    len = opus_repacketizer_out(repacketizer, out, out_size);
+    opus_repacketizer_init(repacketizer);
+    return len < 0 ? -1 : len;
+}
+
+int kvoice::frame_encoder::split_packet(const std::uint8_t* frame, int len, std::uint8_t* out, int out_size) {
+    const int packet_len = opus_repacketizer_out(repacketizer, out, out_size);
+    opus_repacketizer_init(repacketizer);
+
+    // repacketizer keeps pointers to frames, the frame goes to the first slot before the next frames overwrite it
+    std::memmove(frame_storage.data(), frame, static_cast<std::size_t>(len));
+    staged_frames = opus_repacketizer_cat(repacketizer, frame_storage.data(), len) == OPUS_OK ? 1 : 0;
+    return packet_len < 0 ? -1 : packet_len;
+}
+
+template int kvoice::frame_encoder::encode(const float* frame, std::uint8_t* out, int out_size);
+template int kvoice::frame_encoder::encode(const std::int16_t* frame, std::uint8_t* out, int out_size);
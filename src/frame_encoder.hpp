@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+#include "latency_profile.hpp"
+
+struct OpusEncoder;
+struct OpusRepacketizer;
+
+namespace kvoice {
+// default encoder frame of the standard profile, in samples
+constexpr auto kOpusFrameSize = 480;
+// default encoder frame of the low latency profile, in fractions of a second(5 ms)
+constexpr auto kLowLatencyFrameDivider = 200;
+constexpr auto kPacketMaxSize = 32768;
+// max size of a single opus frame
+constexpr auto kFrameMaxSize = 1275;
+constexpr auto kMaxPacketDurationMs = 120;
+
+/**
+ * @brief gets encoder frame size of @p profile
+ * @param sample_rate opus encoder sampling rate
+ * @param frame_size requested frame size, 0 for the profile default
+ * @param profile latency profile
+ * @return frame size in samples
+ * @throws voice_exception if @p frame_size isn't a valid opus frame duration
+ */
+std::int32_t resolve_frame_size(std::int32_t sample_rate, std::uint32_t frame_size, latency_profile profile);
+
+/**
+ * @brief opus encoder that turns fixed size frames into packets of configured duration
+ * @details frames of multi-frame packets are staged and combined with opus repacketizer
+ */
+class frame_encoder {
+public:
+    /**
+     * @brief Constructor
+     * @param sample_rate opus encoder sampling rate
+     * @param bitrate opus encoder bitrate
+     * @param packet_duration_ms duration of one packet, 0 for one frame per packet
+     * @param frame_size samples per frame, see @p resolve_frame_size
+     * @param profile latency profile, low latency encoder uses OPUS_APPLICATION_RESTRICTED_LOWDELAY
+     * @param resource resource of the encoder state and of staged frames
+     * @throws voice_exception if encoder couldn't be created or @p packet_duration_ms isn't a multiple of frame
+     */
+    frame_encoder(std::int32_t sample_rate, std::uint32_t bitrate, std::uint32_t packet_duration_ms,
+                  std::int32_t frame_size, latency_profile profile,
+                  std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+    ~frame_encoder();
+
+    frame_encoder(const frame_encoder&) = delete;
+    frame_encoder& operator=(const frame_encoder&) = delete;
+
+    /**
+     * @brief encodes a frame of @p get_frame_size samples
+     * @param frame samples
+     * @param[out] out packet buffer
+     * @param out_size size of @p out, frames of multi-frame packets are encoded at most at the bitrate that fits
+     * the packet into it
+     * @return packet size, 0 if the frame was staged until the packet is complete, negative if the frame or
+     * the packet was dropped
+     * @details if the frame can't join staged frames, they are returned as a shorter packet and the frame starts
+     * the next one
+     */
+    template <typename SampleT>
+    int encode(const SampleT* frame, std::uint8_t* out, int out_size);
+
+    /**
+     * @brief samples per encoded frame
+     */
+    [[nodiscard]] std::int32_t get_frame_size() const { return frame_size; }
+
+    /**
+     * @brief count of frames staged for the packet being built
+     */
+    [[nodiscard]] std::int32_t get_staged_frames() const { return staged_frames; }
+
+    /**
+     * @brief memory of staged frames, for memory locking
+     */
+    [[nodiscard]] std::pair<void*, std::size_t> staging_memory() {
+        return { frame_storage.data(), frame_storage.size() };
+    }
+
+private:
+    /**
+     * @brief writes staged frames to @p out and stages @p frame as the first frame of the next packet
+     * @return packet size, negative if the packet was dropped
+     */
+    int split_packet(const std::uint8_t* frame, int len, std::uint8_t* out, int out_size);
+
+    std::pmr::memory_resource*     resource{ nullptr };
+    OpusEncoder*                   encoder{ nullptr };
+    OpusRepacketizer*              repacketizer{ nullptr };
+    std::size_t                    encoder_size{ 0 };
+    std::size_t                    repacketizer_size{ 0 };
+    std::int32_t                   frame_size{ kOpusFrameSize };
+    std::int32_t                   frames_per_packet{ 1 };
+    std::int32_t                   staged_frames{ 0 };
+    std::pmr::vector<std::uint8_t> frame_storage;
+};
+}
@@ -0,0 +1,21 @@
+#include "gain_group_impl.hpp"
+
+kvoice::gain_group_impl::gain_group_impl(const gain_group_impl* parent, std::atomic<std::uint32_t>& generation)
+    : parent(parent),
+      generation(generation) {
+}
+
+void kvoice::gain_group_impl::set_gain(float new_gain) {
+    gain.store(new_gain, std::memory_order_relaxed);
+    generation.fetch_add(1, std::memory_order_release);
+}
+
+float kvoice::gain_group_impl::get_gain() const {
+    return gain.load(std::memory_order_relaxed);
+}
+
+float kvoice::gain_group_impl::get_effective_gain() const {
+    float result = 1.f;
+    for (auto* group = this; group; group = group->parent) result *= group->get_gain();
+    return result;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "gain_group.hpp"
+#include "resource_allocated.hpp"
+
+namespace kvoice {
+/**
+ * @brief gain group of one output, every change bumps the generation shared by all groups of the output
+ */
+class gain_group_impl final : public gain_group, public resource_allocated {
+public:
+    /**
+     * @brief Constructor
+     * @param parent parent group, nullptr for a top level group
+     * @param generation change counter of the owning output
+     */
+    gain_group_impl(const gain_group_impl* parent, std::atomic<std::uint32_t>& generation);
+
+    void set_gain(float gain) override;
+
+    [[nodiscard]] float get_gain() const override;
+    [[nodiscard]] float get_effective_gain() const override;
+
+    /**
+     * @brief gets change counter of groups of the owning output
+     * @details streams compare it with the value seen when they applied the gain last time
+     */
+    [[nodiscard]] std::uint32_t get_generation() const { return generation.load(std::memory_order_acquire); }
+
+private:
+    const gain_group_impl*      parent{ nullptr };
+    std::atomic<float>          gain{ 1.f };
+    std::atomic<std::uint32_t>& generation;
+};
+}
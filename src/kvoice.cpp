@@ -2,6 +2,8 @@
 
 #include <alc.h>
 
+#include "async_sound_output.hpp"
+#include "encoder_farm_impl.hpp"
 #include "voice_exception.hpp"
 #include "sound_output_impl.hpp"
 #include "sound_input_impl.hpp"
@@ -44,9 +46,33 @@ std::vector<std::string> kvoice::get_output_devices() {
 kvoice::create_sound_device_result<kvoice::sound_output> kvoice::create_sound_output(
     std::string_view device_name, std::uint32_t sample_rate,
     std::uint32_t    src_count) {
+    sound_output_config config;
+    config.device_name = device_name;
+    config.sample_rate = sample_rate;
+    config.src_count = src_count;
 
+    return create_sound_output(config);
+}
+
+kvoice::create_sound_device_result<kvoice::sound_input> kvoice::create_sound_input(
+    std::string_view device_name, std::uint32_t       sample_rate,
+    std::uint32_t    frames_per_buffer, std::uint32_t bitrate) {
+    sound_input_config config;
+    config.device_name = device_name;
+    config.sample_rate = sample_rate;
+    config.frames_per_buffer = frames_per_buffer;
+    config.bitrate = bitrate;
+
+    return create_sound_input(config);
+}
+
+kvoice::create_sound_device_result<kvoice::sound_output> kvoice::create_sound_output(
+    const sound_output_config& config) {
     try {
-        auto output = std::make_unique<sound_output_impl>(device_name, sample_rate, src_count);
+        auto* const resource = resource_or_default(config.memory_resource);
+        std::unique_ptr<sound_output_impl> output{ new (resource) sound_output_impl(
+            config.device_name, config.sample_rate, config.src_count, config.format, config.lock_memory,
+            config.hibernate_after_ms, config.hibernate_pool_size, config.profile, config.refresh_rate, resource) };
         return { std::move(output), "" };
     } catch (voice_exception& e) {
         return { nullptr, e.what() };
@@ -54,12 +80,46 @@ kvoice::create_sound_device_result<kvoice::sound_output> kvoice::create_sound_ou
 }
 
 kvoice::create_sound_device_result<kvoice::sound_input> kvoice::create_sound_input(
-    std::string_view device_name, std::uint32_t       sample_rate,
-    std::uint32_t    frames_per_buffer, std::uint32_t bitrate) {
+    const sound_input_config& config) {
     try {
-        auto output = std::make_unique<sound_input_impl>(device_name, sample_rate, frames_per_buffer, bitrate);
+        const auto device_rate = config.device_sample_rate != 0 ? config.device_sample_rate : config.sample_rate;
+        auto* const resource = resource_or_default(config.memory_resource);
+        std::unique_ptr<sound_input_impl> output{ new (resource) sound_input_impl(
+            config.device_name, config.sample_rate, config.frames_per_buffer, config.bitrate, config.format,
+            device_rate, config.packet_duration_ms, config.frame_size, config.profile, config.capture_thread, nullptr,
+            resource) };
         return { std::move(output), "" };
     } catch (voice_exception& e) {
         return { nullptr, e.what() };
     }
 }
+
+kvoice::create_sound_device_result<kvoice::sound_output> kvoice::create_sound_output_async(
+    const sound_output_config& config, std::function<on_device_ready_t> on_ready) {
+    auto* const resource = resource_or_default(config.memory_resource);
+    std::unique_ptr<async_sound_output> output{ new (resource) async_sound_output(config, std::move(on_ready)) };
+    return { std::move(output), "" };
+}
+
+kvoice::create_sound_device_result<kvoice::sound_input> kvoice::create_sound_input_async(
+    const sound_input_config& config, std::function<on_device_ready_t> on_ready) {
+    try {
+        const auto device_rate = config.device_sample_rate != 0 ? config.device_sample_rate : config.sample_rate;
+        // empty callback still means deferred open
+        if (!on_ready) on_ready = [](bool, std::string_view) {};
+        auto* const resource = resource_or_default(config.memory_resource);
+        std::unique_ptr<sound_input_impl> output{ new (resource) sound_input_impl(
+            config.device_name, config.sample_rate, config.frames_per_buffer, config.bitrate, config.format,
+            device_rate, config.packet_duration_ms, config.frame_size, config.profile, config.capture_thread,
+            std::move(on_ready), resource) };
+        return { std::move(output), "" };
+    } catch (voice_exception& e) {
+        return { nullptr, e.what() };
+    }
+}
+
+kvoice::create_sound_device_result<kvoice::encoder_farm> kvoice::create_encoder_farm(
+    const encoder_farm_config& config) {
+    std::unique_ptr<encoder_farm> farm{ new (resource_or_default(config.memory_resource)) encoder_farm_impl(config) };
+    return { std::move(farm), "" };
+}
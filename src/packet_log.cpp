@@ -0,0 +1,322 @@
+#include "packet_log.hpp"
+
+#include <cstring>
+#include <limits>
+#include <new>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <Windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+#include "stream.hpp"
+#include "voice_exception.hpp"
+
+namespace {
+// published header count lags written entries by at most this many when records don't overlap
+constexpr std::uint64_t kCountUpdateInterval = 64;
+
+std::atomic<std::uint64_t>& packet_count_of(kvoice::packet_log_header* header) {
+    static_assert(sizeof(std::atomic<std::uint64_t>) == sizeof(std::uint64_t) &&
+                  std::atomic<std::uint64_t>::is_always_lock_free, "packet count can't be updated in place");
+    return *reinterpret_cast<std::atomic<std::uint64_t>*>(&header->packet_count);
+}
+}
+
+kvoice::packet_log_writer::packet_log_writer(std::string_view path, std::uint64_t index_capacity,
+                                             std::uint64_t    payload_capacity, std::uint32_t sample_rate) {
+    const auto max_size = std::numeric_limits<std::size_t>::max();
+    if (index_capacity > (max_size - sizeof(packet_log_header)) / sizeof(packet_log_entry) ||
+        payload_capacity > max_size - sizeof(packet_log_header) - index_capacity * sizeof(packet_log_entry))
+        throw voice_exception::create_formatted("Packet log {} is too large", path);
+
+    const std::uint64_t payload_offset = sizeof(packet_log_header) + index_capacity * sizeof(packet_log_entry);
+    data_size = payload_offset + payload_capacity;
+
+    const std::string path_str{ path };
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path_str.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) throw voice_exception::create_formatted("Couldn't create packet log {}", path);
+
+    // mapping of a larger size extends the file
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(data_size >> 32),
+                                        static_cast<DWORD>(data_size & 0xFFFFFFFF), nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        throw voice_exception::create_formatted("Couldn't reserve packet log {}", path);
+    }
+
+    data = static_cast<std::uint8_t*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0));
+    if (!data) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw voice_exception::create_formatted("Couldn't map packet log {}", path);
+    }
+    file_handle = file;
+    mapping_handle = mapping;
+#else
+    const int fd = open(path_str.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw voice_exception::create_formatted("Couldn't create packet log {}", path);
+
+    // allocate blocks up front where possible, so a full disk fails here instead of faulting in record
+#ifdef __APPLE__
+    const bool reserved = ftruncate(fd, static_cast<off_t>(data_size)) == 0;
+#else
+    const bool reserved = posix_fallocate(fd, 0, static_cast<off_t>(data_size)) == 0;
+#endif
+    if (!reserved) {
+        ::close(fd);
+        throw voice_exception::create_formatted("Couldn't reserve packet log {}", path);
+    }
+
+    void* mapped = mmap(nullptr, static_cast<std::size_t>(data_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        ::close(fd);
+        throw voice_exception::create_formatted("Couldn't map packet log {}", path);
+    }
+    data = static_cast<std::uint8_t*>(mapped);
+    file_descriptor = fd;
+#endif
+
+    header = new (data) packet_log_header{};
+    header->sample_rate = sample_rate;
+    header->index_capacity = index_capacity;
+    header->payload_offset = payload_offset;
+    entries = reinterpret_cast<packet_log_entry*>(data + sizeof(packet_log_header));
+    payload_end.store(payload_offset, std::memory_order_relaxed);
+
+    start_time = std::chrono::steady_clock::now();
+}
+
+kvoice::packet_log_writer::~packet_log_writer() {
+    close();
+}
+
+bool kvoice::packet_log_writer::record(std::uint32_t stream_id, const void* packet, std::size_t size) {
+    // paired with close, which waits for active records after marking the log closed
+    active_records.fetch_add(1);
+    const bool recorded = [&] {
+        packet_log_entry entry;
+        if (closed.load() || !next_sequence(stream_id, entry.sequence)) return false;
+
+        auto offset = payload_end.load(std::memory_order_relaxed);
+        do {
+            if (size > data_size - offset) return false;
+        } while (!payload_end.compare_exchange_weak(offset, offset + size, std::memory_order_relaxed));
+
+        auto slot = reserved_entries.load(std::memory_order_relaxed);
+        do {
+            if (slot >= header->index_capacity) return false;
+        } while (!reserved_entries.compare_exchange_weak(slot, slot + 1, std::memory_order_relaxed));
+
+        entry.stream_id = stream_id;
+        entry.timestamp_us = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_time).count());
+        entry.offset = offset;
+        entry.size = static_cast<std::uint32_t>(size);
+
+        // payload goes first, so a written entry always points to a complete packet
+        std::memcpy(data + offset, packet, size);
+        std::memcpy(&entries[slot], &entry, sizeof(entry));
+
+        publish_count(written_entries.fetch_add(1, std::memory_order_acq_rel) + 1);
+        return true;
+    }();
+    active_records.fetch_sub(1, std::memory_order_release);
+
+    if (!recorded) dropped_packets.fetch_add(1, std::memory_order_relaxed);
+    return recorded;
+}
+
+bool kvoice::packet_log_writer::next_sequence(std::uint32_t stream_id, std::uint32_t& sequence) {
+    const std::uint64_t key = std::uint64_t{ stream_id } + 1;
+    for (std::size_t i = 0, slot = stream_id % kMaxStreams; i < kMaxStreams; ++i, slot = (slot + 1) % kMaxStreams) {
+        auto current = sequence_keys[slot].load(std::memory_order_relaxed);
+        if (current == 0 && sequence_keys[slot].compare_exchange_strong(current, key, std::memory_order_relaxed))
+            current = key;
+        if (current != key) continue;
+
+        sequence = sequences[slot].fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void kvoice::packet_log_writer::publish_count(std::uint64_t written) {
+    // every reserved entry is written only when no other record is between reserving and writing
+    if (written != reserved_entries.load(std::memory_order_acquire)) return;
+
+    auto& count = packet_count_of(header);
+    auto  published = count.load(std::memory_order_relaxed);
+    while (written >= published + kCountUpdateInterval &&
+           !count.compare_exchange_weak(published, written, std::memory_order_relaxed)) {}
+}
+
+bool kvoice::packet_log_writer::close() {
+    if (closed.exchange(true)) return false;
+
+    while (active_records.load() != 0) std::this_thread::yield();
+
+    const auto used_size = payload_end.load(std::memory_order_relaxed);
+    header->packet_count = written_entries.load(std::memory_order_acquire);
+    header->flags |= packet_log_header::kFlagClosed;
+
+    unmap();
+
+#ifdef _WIN32
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(used_size);
+    bool result = SetFilePointerEx(file_handle, end, nullptr, FILE_BEGIN) && SetEndOfFile(file_handle);
+    result = CloseHandle(file_handle) && result;
+    file_handle = nullptr;
+#else
+    bool result = ftruncate(file_descriptor, static_cast<off_t>(used_size)) == 0;
+    result = ::close(file_descriptor) == 0 && result;
+    file_descriptor = -1;
+#endif
+    return result;
+}
+
+void kvoice::packet_log_writer::unmap() {
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mapping_handle) CloseHandle(mapping_handle);
+#else
+    if (data) munmap(data, static_cast<std::size_t>(data_size));
+#endif
+    data = nullptr;
+    header = nullptr;
+    entries = nullptr;
+    mapping_handle = nullptr;
+}
+
+kvoice::packet_log_reader::packet_log_reader(std::string_view path) {
+    const std::string path_str{ path };
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path_str.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) throw voice_exception::create_formatted("Couldn't open packet log {}", path);
+
+    LARGE_INTEGER file_size;
+    HANDLE        mapping = nullptr;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        throw voice_exception::create_formatted("Couldn't map packet log {}", path);
+    }
+
+    data = static_cast<const std::uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!data) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw voice_exception::create_formatted("Couldn't map packet log {}", path);
+    }
+    data_size = static_cast<std::size_t>(file_size.QuadPart);
+    file_handle = file;
+    mapping_handle = mapping;
+#else
+    const int fd = open(path_str.c_str(), O_RDONLY);
+    if (fd < 0) throw voice_exception::create_formatted("Couldn't open packet log {}", path);
+
+    struct stat file_stat{};
+    void*       mapped = MAP_FAILED;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+        mapped = mmap(nullptr, static_cast<std::size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (mapped == MAP_FAILED) throw voice_exception::create_formatted("Couldn't map packet log {}", path);
+
+    madvise(mapped, static_cast<std::size_t>(file_stat.st_size), MADV_SEQUENTIAL);
+    data = static_cast<const std::uint8_t*>(mapped);
+    data_size = static_cast<std::size_t>(file_stat.st_size);
+#endif
+
+    log_header = reinterpret_cast<const packet_log_header*>(data);
+    entries = reinterpret_cast<const packet_log_entry*>(data + sizeof(packet_log_header));
+
+    const auto valid_entry = [this](const packet_log_entry& e) {
+        return e.offset >= log_header->payload_offset && e.offset <= data_size && e.size <= data_size - e.offset;
+    };
+
+    // capacity is checked against the file size before it's multiplied, so the offset can't overflow
+    bool valid = data_size >= sizeof(packet_log_header) &&
+                 log_header->magic == packet_log_header::kMagic &&
+                 log_header->version == packet_log_header::kVersion &&
+                 log_header->index_capacity <= (data_size - sizeof(packet_log_header)) / sizeof(packet_log_entry) &&
+                 log_header->packet_count <= log_header->index_capacity &&
+                 log_header->payload_offset == sizeof(packet_log_header) +
+                 log_header->index_capacity * sizeof(packet_log_entry) &&
+                 log_header->payload_offset <= data_size;
+
+    if (valid) packet_count = static_cast<std::size_t>(log_header->packet_count);
+    for (std::size_t i = 0; valid && i < packet_count; ++i) valid = valid_entry(entries[i]);
+
+    // header count of a log cut off while recording lags behind, unwritten entries are zero,
+    // so the log is readable up to the first unwritten one
+    if (valid && !(log_header->flags & packet_log_header::kFlagClosed)) {
+        while (packet_count < log_header->index_capacity && valid_entry(entries[packet_count])) ++packet_count;
+    }
+
+    if (!valid) {
+        unmap();
+        throw voice_exception::create_formatted("{} isn't a valid packet log", path);
+    }
+}
+
+kvoice::packet_log_reader::~packet_log_reader() {
+    unmap();
+}
+
+void kvoice::packet_log_reader::unmap() {
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mapping_handle) CloseHandle(mapping_handle);
+    if (file_handle) CloseHandle(file_handle);
+#else
+    if (data) munmap(const_cast<std::uint8_t*>(data), data_size);
+#endif
+    data = nullptr;
+    mapping_handle = file_handle = nullptr;
+}
+
+std::size_t kvoice::packet_log_reader::replay(const std::function<packet_sink_t>& sink, float speed,
+                                              const std::atomic<bool>*            stop) const {
+    const auto start = std::chrono::steady_clock::now();
+
+    std::size_t replayed = 0;
+    for (; replayed < size(); ++replayed) {
+        if (stop && stop->load(std::memory_order_relaxed)) break;
+
+        const auto& e = entries[replayed];
+        if (speed > 0.f) {
+            const auto offset = std::chrono::duration<double, std::micro>(static_cast<double>(e.timestamp_us) / speed);
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::microseconds>(offset));
+        }
+        sink(e, payload(e));
+    }
+    return replayed;
+}
+
+std::size_t kvoice::packet_log_reader::replay_to_streams(const std::function<stream*(std::uint32_t)>& resolve,
+                                                         float speed, const std::atomic<bool>* stop) const {
+    std::size_t pushed = 0;
+    replay([&](const packet_log_entry& e, const std::uint8_t* packet) {
+        if (auto* target = resolve(e.stream_id)) {
+            target->push_opus_buffer(packet, e.size);
+            ++pushed;
+        }
+    }, speed, stop);
+    return pushed;
+}
@@ -0,0 +1,91 @@
+#include "resampler.hpp"
+
+#include <cmath>
+#include <numeric>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#   include <xmmintrin.h>
+#   define KVOICE_RESAMPLER_SSE
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#   include <arm_neon.h>
+#   define KVOICE_RESAMPLER_NEON
+#endif
+
+namespace {
+constexpr double kPi = 3.14159265358979323846;
+// passband edge relative to the lower Nyquist frequency
+constexpr double kPassband = 0.92;
+
+double sinc(double x) {
+    if (x == 0.0) return 1.0;
+    return std::sin(kPi * x) / (kPi * x);
+}
+
+double blackman_harris(double n, double length) {
+    const double x = 2.0 * kPi * n / (length - 1);
+    return 0.35875 - 0.48829 * std::cos(x) + 0.14128 * std::cos(2 * x) - 0.01168 * std::cos(3 * x);
+}
+}
+
+kvoice::resampler::resampler(std::uint32_t in_rate, std::uint32_t out_rate, std::size_t max_block,
+                             std::pmr::memory_resource* resource)
+    : coeffs(resource),
+      history(resource) {
+    const auto divisor = std::gcd(in_rate, out_rate);
+    up = out_rate / divisor;
+    down = in_rate / divisor;
+
+    history.resize(kTapsPerPhase - 1 + max_block);
+    reset();
+
+    if (passthrough()) return;
+
+    // prototype low-pass filter runs at in_rate * up, cutoff is below the lower of two Nyquist frequencies
+    const auto   length = static_cast<double>(up) * kTapsPerPhase;
+    const double cutoff = 0.5 * kPassband / static_cast<double>(std::max(up, down));
+    const double center = (length - 1) / 2;
+
+    coeffs.resize(static_cast<std::size_t>(up) * kTapsPerPhase);
+    for (auto p = 0u; p < up; ++p) {
+        for (auto k = 0u; k < kTapsPerPhase; ++k) {
+            const double n = static_cast<double>(p) + static_cast<double>(k) * up;
+            const double h = 2.0 * cutoff * up * sinc(2.0 * cutoff * (n - center)) * blackman_harris(n, length);
+            coeffs[p * kTapsPerPhase + (kTapsPerPhase - 1 - k)] = static_cast<float>(h);
+        }
+    }
+}
+
+std::size_t kvoice::resampler::max_input(std::size_t out_capacity) const {
+    if (out_capacity <= 2) return 0;
+    return (out_capacity - 2) * down / up;
+}
+
+void kvoice::resampler::reset() {
+    std::fill(history.begin(), history.end(), 0.f);
+    history_size = kTapsPerPhase - 1;
+    position = kTapsPerPhase - 1;
+    phase = 0;
+}
+
+float kvoice::resampler::dot(const float* coeffs_row, const float* samples) const {
+#if defined(KVOICE_RESAMPLER_SSE)
+    __m128 sum = _mm_setzero_ps();
+    for (auto i = 0u; i < kTapsPerPhase; i += 4) {
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(coeffs_row + i), _mm_loadu_ps(samples + i)));
+    }
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+    return _mm_cvtss_f32(sum);
+#elif defined(KVOICE_RESAMPLER_NEON)
+    float32x4_t sum = vdupq_n_f32(0.f);
+    for (auto i = 0u; i < kTapsPerPhase; i += 4) {
+        sum = vmlaq_f32(sum, vld1q_f32(coeffs_row + i), vld1q_f32(samples + i));
+    }
+    const float32x2_t half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    return vget_lane_f32(vpadd_f32(half, half), 0);
+#else
+    float sum = 0.f;
+    for (auto i = 0u; i < kTapsPerPhase; ++i) sum += coeffs_row[i] * samples[i];
+    return sum;
+#endif
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+#include "sample_traits.hpp"
+
+namespace kvoice {
+/**
+ * @brief streaming polyphase windowed-sinc resampler between two fixed rates
+ * @details rate ratio is reduced to L/M, output sample n is dot product of a L-phase filter bank row
+ * with the last input samples, vectorized with SSE or NEON where available
+ */
+class resampler {
+public:
+    static constexpr auto kTapsPerPhase = 32u;
+
+    /**
+     * @brief Constructor
+     * @param in_rate input sampling rate
+     * @param out_rate output sampling rate
+     * @param max_block max count of input samples passed to a single @p process call
+     * @param resource resource of the filter bank and history
+     */
+    resampler(std::uint32_t in_rate, std::uint32_t out_rate, std::size_t max_block,
+              std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    /**
+     * @brief checks if rates are equal and resampling isn't needed
+     */
+    [[nodiscard]] bool passthrough() const { return up == 1 && down == 1; }
+
+    /**
+     * @brief upper bound of samples produced from @p in_count input samples
+     */
+    [[nodiscard]] std::size_t max_output(std::size_t in_count) const { return in_count * up / down + 2; }
+
+    /**
+     * @brief count of input samples that always fit into @p out_capacity output samples
+     */
+    [[nodiscard]] std::size_t max_input(std::size_t out_capacity) const;
+
+    /**
+     * @brief resamples next block of input stream
+     * @param in input samples
+     * @param count count of @p in samples, not more than max block passed to constructor
+     * @param[out] out output buffer, at least @p max_output(count) samples
+     * @return count of produced samples
+     */
+    template <typename SampleT>
+    std::size_t process(const SampleT* in, std::size_t count, SampleT* out);
+
+    /**
+     * @brief drops filter history, next block is treated as a start of new stream
+     */
+    void reset();
+
+private:
+    [[nodiscard]] float dot(const float* coeffs, const float* samples) const;
+
+    std::uint32_t up{ 1 };
+    std::uint32_t down{ 1 };
+
+    // kTapsPerPhase coefficients per phase, stored reversed to match history order
+    std::pmr::vector<float> coeffs;
+    std::pmr::vector<float> history;
+    std::size_t             history_size{ 0 };
+    std::size_t             position{ 0 };
+    std::uint32_t           phase{ 0 };
+};
+
+template <typename SampleT>
+std::size_t resampler::process(const SampleT* in, std::size_t count, SampleT* out) {
+    using traits = sample_traits<SampleT>;
+
+    if (passthrough()) {
+        std::copy(in, in + count, out);
+        return count;
+    }
+
+    for (std::size_t i = 0; i < count; ++i) history[history_size + i] = traits::to_float(in[i]);
+    history_size += count;
+
+    std::size_t produced = 0;
+    while (position < history_size) {
+        out[produced++] = traits::from_float(dot(&coeffs[phase * kTapsPerPhase],
+                                                 &history[position + 1 - kTapsPerPhase]));
+        phase += down;
+        position += phase / up;
+        phase %= up;
+    }
+
+    // keep last kTapsPerPhase - 1 samples before the next position as filter history
+    const std::size_t drop = std::min(position + 1 - kTapsPerPhase, history_size);
+    std::copy(history.begin() + static_cast<std::ptrdiff_t>(drop),
+              history.begin() + static_cast<std::ptrdiff_t>(history_size), history.begin());
+    history_size -= drop;
+    position -= drop;
+
+    return produced;
+}
+}
@@ -0,0 +1,56 @@
+#include "resource_allocated.hpp"
+
+namespace {
+// stored right before the object, the object starts kAlignment bytes after the allocation
+struct allocation_header {
+    std::pmr::memory_resource* resource;
+    std::size_t                size;
+};
+
+constexpr auto kAlignment = kvoice::resource_allocated::kAlignment;
+static_assert(sizeof(allocation_header) <= kAlignment);
+
+void* allocate(std::size_t size, std::pmr::memory_resource* resource) {
+    resource = kvoice::resource_or_default(resource);
+
+    const auto total = size + kAlignment;
+    auto*      base = static_cast<std::byte*>(resource->allocate(total, kAlignment));
+    auto*      object = base + kAlignment;
+    new (object - sizeof(allocation_header)) allocation_header{ resource, total };
+    return object;
+}
+
+void deallocate(void* ptr) noexcept {
+    if (!ptr) return;
+
+    auto*      object = static_cast<std::byte*>(ptr);
+    const auto header = *std::launder(reinterpret_cast<allocation_header*>(object - sizeof(allocation_header)));
+    header.resource->deallocate(object - kAlignment, header.size, kAlignment);
+}
+}
+
+void* kvoice::resource_allocated::operator new(std::size_t size, std::pmr::memory_resource* resource) {
+    return allocate(size, resource);
+}
+
+void* kvoice::resource_allocated::operator new(std::size_t size, std::align_val_t align,
+                                               std::pmr::memory_resource* resource) {
+    if (static_cast<std::size_t>(align) > kAlignment) throw std::bad_alloc{};
+    return allocate(size, resource);
+}
+
+void kvoice::resource_allocated::operator delete(void* ptr, std::pmr::memory_resource*) noexcept {
+    deallocate(ptr);
+}
+
+void kvoice::resource_allocated::operator delete(void* ptr, std::align_val_t, std::pmr::memory_resource*) noexcept {
+    deallocate(ptr);
+}
+
+void kvoice::resource_allocated::operator delete(void* ptr) noexcept {
+    deallocate(ptr);
+}
+
+void kvoice::resource_allocated::operator delete(void* ptr, std::align_val_t) noexcept {
+    deallocate(ptr);
+}
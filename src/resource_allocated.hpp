@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+
+#include "ringbuffer.hpp"
+
+namespace kvoice {
+/**
+ * @brief resource passed in a config, or the default resource if there is none
+ */
+inline std::pmr::memory_resource* resource_or_default(std::pmr::memory_resource* resource) noexcept {
+    return resource ? resource : std::pmr::get_default_resource();
+}
+
+/**
+ * @brief base of objects allocated from a memory resource and owned by std::unique_ptr with default deleter
+ * @details objects are created with `new (resource) T(...)`, the resource and the allocation size are stored in
+ * front of the object, so delete returns the memory to the resource it came from
+ */
+class resource_allocated {
+public:
+    // alignment of every allocation, enough for cache line aligned ring buffer indices
+    static constexpr std::size_t kAlignment = kCacheLineSize;
+
+    static void* operator new(std::size_t size, std::pmr::memory_resource* resource);
+    static void* operator new(std::size_t size, std::align_val_t align, std::pmr::memory_resource* resource);
+    // called if the constructor throws
+    static void operator delete(void* ptr, std::pmr::memory_resource* resource) noexcept;
+    static void operator delete(void* ptr, std::align_val_t align, std::pmr::memory_resource* resource) noexcept;
+    static void operator delete(void* ptr) noexcept;
+    static void operator delete(void* ptr, std::align_val_t align) noexcept;
+};
+}
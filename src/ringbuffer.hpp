@@ -13,6 +13,8 @@
 
 #include <limits>
 #include <atomic>
+#include <cstring>
+#include <type_traits>
 
 namespace jnk0le {
 /*!
@@ -21,19 +23,38 @@ namespace jnk0le {
  * \tparam T Type of buffered elements
  * \tparam buffer_size Size of the buffer. Must be a power of 2.
  * \tparam fake_tso Omit generation of explicit barrier code to avoid unnecesary instructions in tso scenario (e.g. simple microcontrollers/single core)
- * \tparam cacheline_size Size of the cache line, to insert appropriate padding in between indexes and buffer
+ * \tparam cacheline_size Size of the cache line, to insert appropriate padding in between indexes and buffer.
+ * Each side also keeps a cached copy of the opposite index next to its own, and reloads it only when the cached
+ * value doesn't allow the operation, so the sides touch each other's cache line only when buffer looks full or empty
  * \tparam index_t Type of array indexing type. Serves also as placeholder for future implementations.
  */
 template <typename T, size_t buffer_size = 16, bool fake_tso = false, size_t cacheline_size = 0, typename index_t =
           size_t>
 class Ringbuffer {
 public:
+    /*!
+     * \brief Up to two contiguous regions of the internal buffer, in FIFO order
+     */
+    struct Spans {
+        T*     first;       //!< first region, nullptr if its size is 0
+        size_t first_size;  //!< number of elements in first region
+        T*     second;      //!< wrapped around region, nullptr if its size is 0
+        size_t second_size; //!< number of elements in second region
+
+        /*!
+         * \brief Total number of elements in both regions
+         */
+        size_t size() const { return first_size + second_size; }
+    };
+
     /*!
      * \brief Default constructor, will initialize head and tail indexes
      */
     Ringbuffer()
         : head(0),
-          tail(0) {
+          cached_tail(0),
+          tail(0),
+          cached_head(0) {
     }
 
     /*!
@@ -47,7 +68,7 @@ public:
 
     /*!
      * \brief Clear buffer from producer side
-     * \warning function may return without performing any action if consumer tries to read data at the same time
+     * \warning consumer must not access the buffer at the same time, its cached index is updated too
      */
     void producerClear(void) {
         // head modification will lead to underflow if cleared during consumer read
@@ -59,7 +80,8 @@ public:
      * \brief Clear buffer from consumer side
      */
     void consumerClear(void) {
-        tail.store(head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        cached_head = head.load(index_acquire_barrier);
+        tail.store(cached_head, index_release_barrier);
     }
 
     /*!
@@ -102,7 +124,7 @@ public:
     bool insert(T data) {
         index_t tmp_head = head.load(std::memory_order_relaxed);
 
-        if ((tmp_head - tail.load(index_acquire_barrier)) == buffer_size)
+        if (producerFree(tmp_head, 1) == 0)
             return false;
         else {
             data_buff[tmp_head++ & buffer_mask] = data;
@@ -120,7 +142,7 @@ public:
     bool insert(const T* data) {
         index_t tmp_head = head.load(std::memory_order_relaxed);
 
-        if ((tmp_head - tail.load(index_acquire_barrier)) == buffer_size)
+        if (producerFree(tmp_head, 1) == 0)
             return false;
         else {
             data_buff[tmp_head++ & buffer_mask] = *data;
@@ -142,7 +164,7 @@ public:
     bool insertFromCallbackWhenAvailable(T (*get_data_callback)(void)) {
         index_t tmp_head = head.load(std::memory_order_relaxed);
 
-        if ((tmp_head - tail.load(index_acquire_barrier)) == buffer_size)
+        if (producerFree(tmp_head, 1) == 0)
             return false;
         else {
             //execute callback only when there is space in buffer
@@ -160,7 +182,7 @@ public:
     bool remove() {
         index_t tmp_tail = tail.load(std::memory_order_relaxed);
 
-        if (tmp_tail == head.load(std::memory_order_relaxed))
+        if (consumerAvailable(tmp_tail, 1) == 0)
             return false;
         else
             tail.store(++tmp_tail, index_release_barrier); // release in case data was loaded/used before
@@ -175,7 +197,7 @@ public:
      */
     size_t remove(size_t cnt) {
         index_t tmp_tail = tail.load(std::memory_order_relaxed);
-        index_t avail = head.load(std::memory_order_relaxed) - tmp_tail;
+        index_t avail = consumerAvailable(tmp_tail, cnt);
 
         cnt = (cnt > avail) ? avail : cnt;
 
@@ -200,7 +222,7 @@ public:
     bool remove(T* data) {
         index_t tmp_tail = tail.load(std::memory_order_relaxed);
 
-        if (tmp_tail == head.load(index_acquire_barrier))
+        if (consumerAvailable(tmp_tail, 1) == 0)
             return false;
         else {
             *data = data_buff[tmp_tail++ & buffer_mask];
@@ -220,7 +242,7 @@ public:
     T* peek() {
         index_t tmp_tail = tail.load(std::memory_order_relaxed);
 
-        if (tmp_tail == head.load(index_acquire_barrier))
+        if (consumerAvailable(tmp_tail, 1) == 0)
             return nullptr;
         else
             return &data_buff[tmp_tail & buffer_mask];
@@ -237,7 +259,7 @@ public:
     T* at(size_t index) {
         index_t tmp_tail = tail.load(std::memory_order_relaxed);
 
-        if ((head.load(index_acquire_barrier) - tmp_tail) <= index)
+        if (consumerAvailable(tmp_tail, index + 1) <= index)
             return nullptr;
         else
             return &data_buff[(tmp_tail + index) & buffer_mask];
@@ -258,6 +280,56 @@ public:
         return data_buff[(tail.load(std::memory_order_relaxed) + index) & buffer_mask];
     }
 
+    /*!
+     * \brief Gets free regions of the buffer that can be written in place
+     *
+     * It is safe to use only on producer side, written data becomes visible to consumer after commitWrite()
+     *
+     * \param min_count Consumer index is reloaded only if fewer free slots are known, regions may be smaller than
+     * the actual free space if it isn't
+     * \return Free regions, starting at the current head
+     */
+    Spans peekWrite(size_t min_count = 1) {
+        index_t tmp_head = head.load(std::memory_order_relaxed);
+        size_t  available = producerFree(tmp_head, min_count);
+
+        return makeSpans(tmp_head & buffer_mask, available);
+    }
+
+    /*!
+     * \brief Publishes elements written in place into regions returned by peekWrite()
+     * \param count Number of written elements, must not exceed size of peeked regions
+     */
+    void commitWrite(size_t count) {
+        std::atomic_signal_fence(std::memory_order_release);
+        head.store(head.load(std::memory_order_relaxed) + count, index_release_barrier);
+    }
+
+    /*!
+     * \brief Gets filled regions of the buffer that can be read in place
+     *
+     * It is safe to use only on consumer side, regions stay valid until commitRead()
+     *
+     * \param min_count Producer index is reloaded only if fewer filled slots are known, regions may be smaller than
+     * the actual filled space if it isn't
+     * \return Filled regions, starting at the current tail
+     */
+    Spans peekRead(size_t min_count = 1) {
+        index_t tmp_tail = tail.load(std::memory_order_relaxed);
+        size_t  available = consumerAvailable(tmp_tail, min_count);
+
+        return makeSpans(tmp_tail & buffer_mask, available);
+    }
+
+    /*!
+     * \brief Releases elements consumed in place from regions returned by peekRead()
+     * \param count Number of consumed elements, must not exceed size of peeked regions
+     */
+    void commitRead(size_t count) {
+        std::atomic_signal_fence(std::memory_order_release);
+        tail.store(tail.load(std::memory_order_relaxed) + count, index_release_barrier);
+    }
+
     /*!
      * \brief Insert multiple elements into internal buffer without blocking
      *
@@ -314,6 +386,45 @@ public:
     size_t readBuff(T* buff, size_t count, size_t count_to_callback, void (*execute_data_callback)(void));
 
 private:
+    // producer side, free slots known from the cached consumer index, reloaded if fewer than wanted
+    index_t producerFree(index_t tmp_head, size_t wanted) {
+        index_t free_slots = buffer_size - (tmp_head - cached_tail);
+        if (free_slots < wanted) {
+            cached_tail = tail.load(index_acquire_barrier);
+            free_slots = buffer_size - (tmp_head - cached_tail);
+        }
+        return free_slots;
+    }
+
+    // consumer side, filled slots known from the cached producer index, reloaded if fewer than wanted
+    index_t consumerAvailable(index_t tmp_tail, size_t wanted) {
+        index_t filled = cached_head - tmp_tail;
+        if (filled < wanted) {
+            cached_head = head.load(index_acquire_barrier);
+            filled = cached_head - tmp_tail;
+        }
+        return filled;
+    }
+
+    Spans makeSpans(size_t offset, size_t count) {
+        const size_t first_size = (buffer_size - offset) < count ? (buffer_size - offset) : count;
+        const size_t second_size = count - first_size;
+
+        // empty region must not point into the buffer, a full buffer would hand out a slot still being read
+        return { first_size ? &data_buff[offset] : nullptr, first_size, second_size ? data_buff : nullptr,
+                 second_size };
+    }
+
+    static void copyElements(T* dst, const T* src, size_t count) {
+        if constexpr (std::is_trivially_copyable<T>::value) {
+            if (count > 0)
+                std::memcpy(dst, src, count * sizeof(T));
+        } else {
+            for (size_t i = 0; i < count; i++)
+                dst[i] = src[i];
+        }
+    }
+
     constexpr static index_t           buffer_mask = buffer_size - 1; //!< bitwise mask for a given buffer size
     constexpr static std::memory_order index_acquire_barrier = fake_tso
                                                                    ? std::memory_order_relaxed
@@ -324,11 +435,18 @@ private:
                                                                    : std::memory_order_release;
     // do not update own side before all operations on data_buff committed
 
-    alignas(cacheline_size) std::atomic<index_t> head; //!< head index
-    alignas(cacheline_size) std::atomic<index_t> tail; //!< tail index
+    // alignas(0) is ignored by the standard but warned about by compilers, so no padding means natural alignment
+    constexpr static size_t index_alignment = cacheline_size ? cacheline_size : alignof(std::atomic<index_t>);
+    constexpr static size_t buffer_alignment = cacheline_size ? cacheline_size : alignof(T);
+
+    alignas(index_alignment) std::atomic<index_t> head; //!< head index
+    index_t cached_tail; //!< consumer index last seen by producer, on producer cache line
+
+    alignas(index_alignment) std::atomic<index_t> tail; //!< tail index
+    index_t cached_head; //!< producer index last seen by consumer, on consumer cache line
 
     // put buffer after variables so everything can be reached with short offsets
-    alignas(cacheline_size) T data_buff[buffer_size]; //!< actual buffer
+    alignas(buffer_alignment) T data_buff[buffer_size]; //!< actual buffer
 
     // let's assert that no UB will be compiled in
     static_assert((buffer_size != 0), "buffer cannot be of zero size");
@@ -348,14 +466,16 @@ size_t Ringbuffer<T, buffer_size, fake_tso, cacheline_size, index_t>::writeBuff(
     index_t tmp_head = head.load(std::memory_order_relaxed);
     size_t  to_write = count;
 
-    available = buffer_size - (tmp_head - tail.load(index_acquire_barrier));
+    available = producerFree(tmp_head, count);
 
     if (available < count) // do not write more than we can
         to_write = available;
 
-    // maybe divide it into 2 separate writes
-    for (size_t i = 0; i < to_write; i++)
-        data_buff[tmp_head++ & buffer_mask] = buff[i];
+    // copy contiguous part up to the end of the buffer, then the wrapped around part
+    const Spans spans = makeSpans(tmp_head & buffer_mask, to_write);
+    copyElements(spans.first, buff, spans.first_size);
+    copyElements(spans.second, buff + spans.first_size, spans.second_size);
+    tmp_head += to_write;
 
     std::atomic_signal_fence(std::memory_order_release);
     head.store(tmp_head, index_release_barrier);
@@ -375,7 +495,7 @@ size_t Ringbuffer<T, buffer_size, fake_tso, cacheline_size, index_t>::writeBuff(
         to_write = count_to_callback;
 
     while (written < count) {
-        available = buffer_size - (tmp_head - tail.load(index_acquire_barrier));
+        available = producerFree(tmp_head, count - written);
 
         if (available == 0) // less than ??
             break;
@@ -404,14 +524,16 @@ size_t Ringbuffer<T, buffer_size, fake_tso, cacheline_size, index_t>::readBuff(T
     index_t tmp_tail = tail.load(std::memory_order_relaxed);
     size_t  to_read = count;
 
-    available = head.load(index_acquire_barrier) - tmp_tail;
+    available = consumerAvailable(tmp_tail, count);
 
     if (available < count) // do not read more than we can
         to_read = available;
 
-    // maybe divide it into 2 separate reads
-    for (size_t i = 0; i < to_read; i++)
-        buff[i] = data_buff[tmp_tail++ & buffer_mask];
+    // copy contiguous part up to the end of the buffer, then the wrapped around part
+    const Spans spans = makeSpans(tmp_tail & buffer_mask, to_read);
+    copyElements(buff, spans.first, spans.first_size);
+    copyElements(buff + spans.first_size, spans.second, spans.second_size);
+    tmp_tail += to_read;
 
     std::atomic_signal_fence(std::memory_order_release);
     tail.store(tmp_tail, index_release_barrier);
@@ -432,7 +554,7 @@ size_t Ringbuffer<T, buffer_size, fake_tso, cacheline_size, index_t>::readBuff(T
         to_read = count_to_callback;
 
     while (read < count) {
-        available = head.load(index_acquire_barrier) - tmp_tail;
+        available = consumerAvailable(tmp_tail, count - read);
 
         if (available == 0) // less than ??
             break;
@@ -457,4 +579,15 @@ size_t Ringbuffer<T, buffer_size, fake_tso, cacheline_size, index_t>::readBuff(T
 
 } // namespace
 
+namespace kvoice {
+/**
+ * @brief padding that keeps ring buffer indices of different cores on separate cache lines
+ */
+#if defined(__APPLE__) && defined(__aarch64__)
+constexpr std::size_t kCacheLineSize = 128;
+#else
+constexpr std::size_t kCacheLineSize = 64;
+#endif
+}
+
 #endif //RINGBUFFER_HPP
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <AL/al.h>
+#include <AL/alext.h>
+#include <opus.h>
+
+#include "sample_format.hpp"
+
+namespace kvoice {
+/**
+ * @brief per sample type codec and OpenAL glue
+ * @tparam SampleT type of stored samples
+ */
+template <typename SampleT>
+struct sample_traits;
+
+template <>
+struct sample_traits<float> {
+    static constexpr auto kFormat = sample_format::float32;
+    static constexpr auto kAlFormat = AL_FORMAT_MONO_FLOAT32;
+
+    static int decode(OpusDecoder* decoder, const unsigned char* data, int len, float* pcm, int frame_size) {
+        return opus_decode_float(decoder, data, len, pcm, frame_size, 0);
+    }
+
+    static int encode(OpusEncoder* encoder, const float* pcm, int frame_size, unsigned char* data, int max_size) {
+        return opus_encode_float(encoder, pcm, frame_size, data, max_size);
+    }
+
+    static float to_float(float sample) { return sample; }
+    static float from_float(float sample) { return sample; }
+};
+
+template <>
+struct sample_traits<std::int16_t> {
+    static constexpr auto kFormat = sample_format::int16;
+    static constexpr auto kAlFormat = AL_FORMAT_MONO16;
+
+    static int decode(OpusDecoder* decoder, const unsigned char* data, int len, std::int16_t* pcm, int frame_size) {
+        return opus_decode(decoder, data, len, pcm, frame_size, 0);
+    }
+
+    static int encode(OpusEncoder*        encoder, const std::int16_t* pcm, int frame_size, unsigned char* data,
+                      int                 max_size) {
+        return opus_encode(encoder, pcm, frame_size, data, max_size);
+    }
+
+    static float to_float(std::int16_t sample) { return static_cast<float>(sample) / 32768.f; }
+
+    static std::int16_t from_float(float sample) {
+        return static_cast<std::int16_t>(std::clamp(std::lround(sample * 32768.f), -32768l, 32767l));
+    }
+};
+
+/**
+ * @brief scales sample with saturation
+ * @param sample sample to scale
+ * @param gain scale factor
+ * @return scaled sample
+ */
+template <typename SampleT>
+SampleT apply_gain(SampleT sample, float gain) {
+    using traits = sample_traits<SampleT>;
+    return traits::from_float(traits::to_float(sample) * gain);
+}
+}
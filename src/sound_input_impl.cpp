@@ -3,43 +3,81 @@
 #include <AL/alc.h>
 #include <AL/al.h>
 #include <AL/alext.h>
-#include <opus.h>
 
 #include <algorithm>
 #include <array>
 #include <boost/circular_buffer.hpp>
 
+#include "packet_log.hpp"
+#include "resampler.hpp"
+#include "sample_traits.hpp"
+#include "thread_utils.hpp"
+#include "tracing.hpp"
 #include "voice_exception.hpp"
 
+namespace {
+ALCenum capture_format(kvoice::sample_format format) {
+    return format == kvoice::sample_format::int16
+               ? kvoice::sample_traits<std::int16_t>::kAlFormat
+               : kvoice::sample_traits<float>::kAlFormat;
+}
+}
+
 kvoice::sound_input_impl::sound_input_impl(std::string_view device_name, std::int32_t        sample_rate,
-                                           std::int32_t     frames_per_buffer, std::uint32_t bitrate)
+                                           std::int32_t     frames_per_buffer, std::uint32_t bitrate,
+                                           sample_format    format, std::int32_t device_rate,
+                                           std::uint32_t    packet_duration_ms, std::uint32_t frame_size,
+                                           latency_profile  profile, const thread_config& thread,
+                                           std::function<on_device_ready_t> on_ready,
+                                           std::pmr::memory_resource* resource)
     : sample_rate_(sample_rate),
+      device_rate_(device_rate),
       frames_per_buffer_(frames_per_buffer),
-      input_device(alcCaptureOpenDevice(device_name.data(), sample_rate, AL_FORMAT_MONO_FLOAT32, frames_per_buffer)) {
-
-    if (!input_device) throw voice_exception::create_formatted("Couldn't open capture device {}", device_name);
+      read_frames_(frames_per_buffer),
+      format_(format),
+      thread_name(thread.name),
+      thread_settings(thread),
+      resource(resource),
+      frame_coder(sample_rate, bitrate, packet_duration_ms, resolve_frame_size(sample_rate, frame_size, profile),
+                  profile, resource),
+      on_device_ready(std::move(on_ready)) {
+    // low latency capture reads every encoder frame as soon as it is captured, the device buffer stays larger
+    if (profile == latency_profile::low_latency) {
+        const auto frame_device_samples = static_cast<std::int64_t>(frame_coder.get_frame_size()) * device_rate /
+                                          sample_rate;
+        read_frames_ = static_cast<std::int32_t>(std::clamp<std::int64_t>(frame_device_samples, 1, frames_per_buffer));
+    }
 
-    sleep_time = std::chrono::milliseconds{ frames_per_buffer * 500 / sample_rate };
+    if (on_device_ready) {
+        pending_device = device_name;
+        device_pending = true;
+    } else {
+        input_device = alcCaptureOpenDevice(device_name.data(), device_rate, capture_format(format),
+                                            frames_per_buffer);
+        if (!input_device)
+            throw voice_exception::create_formatted("Couldn't open capture device {}", device_name);
+    }
 
-    int opus_err;
-    encoder = opus_encoder_create(sample_rate, 1, OPUS_APPLICATION_VOIP, &opus_err);
+    // config name is a view of caller's string, keep own copy for the thread
+    thread_settings.name = thread_name;
 
-    if (opus_err != OPUS_OK || !encoder)
-        throw voice_exception::create_formatted("Couldn't create opus encoder (errc = {})", opus_err);
+    if (alcIsExtensionPresent(nullptr, "ALC_SOFT_device_clock"))
+        get_integer64v = reinterpret_cast<get_integer64v_t>(alcGetProcAddress(nullptr, "alcGetInteger64vSOFT"));
 
-    if ((opus_err = opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate))) != OPUS_OK)
-        throw voice_exception::create_formatted("Couldn't set encoder bitrate (errc = {})", opus_err);
+    sleep_time = std::chrono::microseconds{ static_cast<std::int64_t>(read_frames_) * 500'000 / device_rate };
 
     input_alive = true;
-    input_thread = std::thread(&sound_input_impl::process_input, this);
+    if (format == sample_format::int16)
+        input_thread = std::thread(&sound_input_impl::process_input<std::int16_t>, this);
+    else
+        input_thread = std::thread(&sound_input_impl::process_input<float>, this);
 }
 
 kvoice::sound_input_impl::~sound_input_impl() {
     input_alive = false;
     input_thread.join();
 
-    alcCaptureCloseDevice(input_device);
-    opus_encoder_destroy(encoder);
+    if (input_device) alcCaptureCloseDevice(input_device);
 }
 
 bool kvoice::sound_input_impl::enable_input() {
@@ -50,6 +88,11 @@ bool kvoice::sound_input_impl::enable_input() {
             alcCaptureStart(input_device);
             return true;
         }
+        // capture starts once the device is open
+        if (device_pending) {
+            input_active = true;
+            return true;
+        }
         return false;
     }
     return false;
@@ -74,13 +117,42 @@ void kvoice::sound_input_impl::set_mic_gain(float gain) {
 void kvoice::sound_input_impl::change_device(std::string_view device_name) {
     std::unique_lock lck(device_mutex);
 
-    alcCaptureCloseDevice(input_device);
+    if (input_device) alcCaptureCloseDevice(input_device);
+    device_pending = false;
 
-    input_device = alcCaptureOpenDevice(device_name.data(), sample_rate_, AL_FORMAT_MONO_FLOAT32, frames_per_buffer_);
+    input_device = alcCaptureOpenDevice(device_name.data(), device_rate_, capture_format(format_),
+                                        frames_per_buffer_);
 
     if (!input_device) throw voice_exception::create_formatted("Couldn't open capture device {}", device_name);
 }
 
+void kvoice::sound_input_impl::open_pending_device() {
+    std::string error;
+    {
+        std::unique_lock lck(device_mutex);
+        // change_device could have been called meanwhile
+        if (!device_pending) return;
+        device_pending = false;
+
+        input_device = alcCaptureOpenDevice(pending_device.c_str(), device_rate_, capture_format(format_),
+                                            frames_per_buffer_);
+        if (!input_device)
+            error = fmt::format("Couldn't open capture device {}", pending_device);
+        else if (input_active)
+            alcCaptureStart(input_device);
+    }
+
+    on_device_ready(error.empty(), error);
+}
+
+std::int64_t kvoice::sound_input_impl::capture_latency_ns() {
+    if (!get_integer64v) return 0;
+
+    std::int64_t latency = 0;
+    get_integer64v(input_device, ALC_DEVICE_LATENCY_SOFT, 1, &latency);
+    return latency > 0 ? latency : 0;
+}
+
 void kvoice::sound_input_impl::set_input_callback(std::function<on_voice_input_t> cb) {
     on_voice_input = std::move(cb);
 }
@@ -89,16 +161,165 @@ void kvoice::sound_input_impl::set_raw_input_callback(std::function<on_voice_raw
     on_raw_voice_input = std::move(cb);
 }
 
+void kvoice::sound_input_impl::set_timed_input_callback(std::function<on_voice_timed_input_t> cb) {
+    on_timed_voice_input = std::move(cb);
+}
+
+kvoice::thread_report kvoice::sound_input_impl::get_thread_report() const {
+    std::unique_lock lck(report_mutex);
+    return thread_state;
+}
+
+kvoice::input_stats kvoice::sound_input_impl::get_stats() const {
+    input_stats result;
+
+    const auto encoded = stats.encoded_packets.load(std::memory_order_relaxed);
+
+    result.captured_samples = stats.captured_samples.load(std::memory_order_relaxed);
+    result.capture_backlog = stats.capture_backlog.load(std::memory_order_relaxed);
+    result.overruns = stats.overruns.load(std::memory_order_relaxed);
+    result.encoded_packets = encoded;
+    result.dropped_packets = stats.dropped_packets.load(std::memory_order_relaxed);
+    result.queue_overflows = stats.queue_overflows.load(std::memory_order_relaxed);
+    if (encoded > 0) {
+        result.avg_encode_time_us = static_cast<float>(stats.encode_time_ns.load(std::memory_order_relaxed)) /
+                                    static_cast<float>(encoded) / 1000.f;
+    }
+    return result;
+}
+
+void kvoice::sound_input_impl::set_packet_log(packet_log_writer* writer, std::uint32_t stream_id) {
+    packet_log_id.store(stream_id, std::memory_order_relaxed);
+    packet_log.store(writer, std::memory_order_release);
+}
+
+void kvoice::sound_input_impl::set_packet_queue_enabled(bool enabled) {
+    queue_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool kvoice::sound_input_impl::try_pop(encoded_packet& packet) {
+    if (packet_queue.remove(packet)) return true;
+
+    // reset before the second check, so a packet pushed in between keeps the handle signaled
+    packet_event.reset();
+    return packet_queue.remove(packet);
+}
+
+std::size_t kvoice::sound_input_impl::pop_batch(encoded_packet* packets, std::size_t max_count) {
+    packet_event.reset();
+    const auto popped = packet_queue.readBuff(packets, max_count);
+    if (!packet_queue.isEmpty()) packet_event.signal();
+    return popped;
+}
+
+kvoice::wakeup_handle_t kvoice::sound_input_impl::get_wakeup_handle() const {
+    return packet_event.native_handle();
+}
+
+template <typename SampleT>
+void kvoice::sound_input_impl::encode_frame(const SampleT* frame, std::uint8_t* packet, std::int64_t capture_ns) {
+    // in queue mode the packet goes straight into the free queue slot, the scratch packet is used only on overflow
+    // and its packet is dropped, so encoder state stays continuous
+    const bool      to_queue = queue_enabled.load(std::memory_order_relaxed);
+    encoded_packet* slot = nullptr;
+    if (to_queue) {
+        const auto spans = packet_queue.peekWrite();
+        if (spans.first_size > 0) slot = spans.first;
+    }
+    std::uint8_t*   out = slot ? slot->data : packet;
+    const int       out_size = slot ? static_cast<int>(encoded_packet::kMaxSize) : kPacketMaxSize;
+
+    // packet is timestamped with its first frame
+    if (frame_coder.get_staged_frames() == 0) packet_capture_ns = capture_ns;
+
+    const auto encode_start = std::chrono::steady_clock::now();
+    int        len;
+    {
+        KVOICE_TRACE_SCOPE(opus_encode);
+        len = frame_coder.encode(frame, out, out_size);
+    }
+    if (len < 0) {
+        // drop the frame, but keep capturing
+        stats.dropped_packets.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    const auto encode_end = std::chrono::steady_clock::now();
+    stats.encode_time_ns.fetch_add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(encode_end - encode_start).count(),
+        std::memory_order_relaxed);
+
+    // frame staged until the packet is complete
+    if (len == 0) return;
+
+    stats.encoded_packets.fetch_add(1, std::memory_order_relaxed);
+
+    if (auto* log = packet_log.load(std::memory_order_acquire))
+        log->record(packet_log_id.load(std::memory_order_relaxed), out, len);
+
+    const auto packet_sequence = sequence++;
+    const auto capture_time_us = static_cast<std::uint64_t>(packet_capture_ns / 1000);
+    // packet was split before this frame, the frame starts the next packet
+    if (frame_coder.get_staged_frames() > 0) packet_capture_ns = capture_ns;
+    if (slot) {
+        slot->size = static_cast<std::uint32_t>(len);
+        slot->sequence = packet_sequence;
+        slot->timestamp_us = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(encode_end.time_since_epoch()).count());
+        slot->capture_time_us = capture_time_us;
+        packet_queue.commitWrite(1);
+        packet_event.signal();
+    } else if (to_queue) {
+        stats.queue_overflows.fetch_add(1, std::memory_order_relaxed);
+    } else if (on_timed_voice_input) {
+        KVOICE_TRACE_SCOPE(input_callback);
+        on_timed_voice_input(out, len, capture_time_us);
+    } else if (on_voice_input) {
+        KVOICE_TRACE_SCOPE(input_callback);
+        on_voice_input(out, len);
+    }
+}
+
+template <typename SampleT>
 void kvoice::sound_input_impl::process_input() {
     using namespace std::chrono_literals;
 
     std::array<std::uint8_t, kPacketMaxSize> packet{};
-    std::vector<float>                       capture_buffer(frames_per_buffer_);
-    std::vector<float>                       temporary_buffer;
-    temporary_buffer.reserve(kOpusFrameSize);
+    std::pmr::vector<SampleT>                capture_buffer(read_frames_, resource);
+    std::pmr::vector<SampleT>                temporary_buffer(resource);
+    temporary_buffer.reserve(frame_coder.get_frame_size());
+
+    resampler                 converter(device_rate_, sample_rate_, read_frames_, resource);
+    std::pmr::vector<SampleT> resampled_buffer(converter.max_output(read_frames_), resource);
+
+    auto report = apply_thread_config(thread_settings, "kvoice-capture");
+
+    if (on_device_ready) open_pending_device();
+
+    // locked ranges, unlocked when the thread exits
+    const std::pair<void*, std::size_t> locked_ranges[] = {
+        { this, sizeof(*this) },
+        { packet.data(), packet.size() },
+        { capture_buffer.data(), capture_buffer.capacity() * sizeof(SampleT) },
+        { temporary_buffer.data(), temporary_buffer.capacity() * sizeof(SampleT) },
+        { resampled_buffer.data(), resampled_buffer.capacity() * sizeof(SampleT) },
+        frame_coder.staging_memory(),
+    };
+    if (thread_settings.lock_memory) {
+        report.memory_locked = std::all_of(std::begin(locked_ranges), std::end(locked_ranges),
+                                           [](const auto& range) { return lock_memory(range.first, range.second); });
+        if (!report.memory_locked) report.errors += report.errors.empty() ? "couldn't lock memory"
+                                                                          : "; couldn't lock memory";
+    }
+    {
+        std::unique_lock lck(report_mutex);
+        thread_state = std::move(report);
+    }
 
     std::int32_t captured_frames;
     bool         buffer_captured;
+    // capture times of the first sample of captured buffer and of the temporary buffer, in ns of steady_clock
+    std::int64_t buffer_capture_ns = 0;
+    std::int64_t temporary_capture_ns = 0;
 
     while (input_alive) {
         buffer_captured = false;
@@ -110,66 +331,80 @@ void kvoice::sound_input_impl::process_input() {
                 continue;
             }
             alcGetIntegerv(input_device, ALC_CAPTURE_SAMPLES, 1, &captured_frames);
-            if (captured_frames >= frames_per_buffer_) {
-                capture_buffer.resize(frames_per_buffer_);
-                alcCaptureSamples(input_device, capture_buffer.data(), frames_per_buffer_);
+            if (captured_frames > frames_per_buffer_)
+                stats.overruns.fetch_add(1, std::memory_order_relaxed);
+            if (captured_frames >= read_frames_) {
+                {
+                    KVOICE_TRACE_SCOPE(capture_samples);
+                    alcCaptureSamples(input_device, capture_buffer.data(), read_frames_);
+                }
                 buffer_captured = true;
+
+                // the newest of captured frames was captured about now, the read ones are the oldest
+                const auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+                buffer_capture_ns = now_ns - static_cast<std::int64_t>(captured_frames) * 1'000'000'000 / device_rate_ -
+                                    capture_latency_ns();
+
+                stats.captured_samples.fetch_add(read_frames_, std::memory_order_relaxed);
+                captured_frames -= read_frames_;
             }
+            stats.capture_backlog.store(static_cast<std::uint32_t>(captured_frames), std::memory_order_relaxed);
         }
 
         if (buffer_captured) {
-            float mic_level = *std::max_element(capture_buffer.begin(), capture_buffer.end());
+            float mic_level = sample_traits<SampleT>::to_float(
+                *std::max_element(capture_buffer.begin(), capture_buffer.end()));
 
-            on_raw_voice_input(capture_buffer.data(), capture_buffer.size(), mic_level);
+            {
+                KVOICE_TRACE_SCOPE(raw_input_callback);
+                on_raw_voice_input(capture_buffer.data(), capture_buffer.size(), mic_level);
+            }
 
             std::transform(capture_buffer.begin(), capture_buffer.end(), capture_buffer.begin(),
-                           [gain = input_gain.load()](const float v) { return v * gain; });
-
-            std::ptrdiff_t needed_data = kOpusFrameSize - static_cast<std::ptrdiff_t>(temporary_buffer.size());
-
-            // move all data to temp buffer by default
-            auto end_it = capture_buffer.end();
-
-            if (needed_data < static_cast<std::ptrdiff_t>(capture_buffer.size())) {
-                // move only needed amount of data if needed data size < captured data size
-                end_it = std::next(capture_buffer.begin(), needed_data);
+                           [gain = input_gain.load()](const SampleT v) { return apply_gain(v, gain); });
+
+            // samples are read in place from the capture or resampled buffer, nothing is shifted or reallocated
+            const SampleT* input = capture_buffer.data();
+            std::size_t    input_size = capture_buffer.size();
+            if (!converter.passthrough()) {
+                input_size = converter.process(capture_buffer.data(), capture_buffer.size(), resampled_buffer.data());
+                input = resampled_buffer.data();
             }
 
-            // move
-            temporary_buffer.insert(temporary_buffer.cend(), std::make_move_iterator(capture_buffer.begin()),
-                                    std::make_move_iterator(end_it));
-            capture_buffer.erase(capture_buffer.begin(), end_it);
-
-            // if there enough data then pass it to the encoder
-            if (temporary_buffer.size() == kOpusFrameSize) {
-                // encode data and pass it to callback, then clear temporary data buffer
-                int len = opus_encode_float(encoder, temporary_buffer.data(), kOpusFrameSize, packet.data(),
-                                            kPacketMaxSize);
-                if (len < 0 || len > kPacketMaxSize) return;
-                on_voice_input(packet.data(), len);
-                temporary_buffer.clear();
+            // capture time of the sample at index of the input
+            const auto sample_capture_ns = [&](std::size_t index) {
+                return buffer_capture_ns + static_cast<std::int64_t>(index) * 1'000'000'000 / sample_rate_;
+            };
+            const auto  frame_size = static_cast<std::size_t>(frame_coder.get_frame_size());
+            std::size_t offset = 0;
+
+            // complete the frame started by the previous buffer
+            if (!temporary_buffer.empty()) {
+                offset = std::min(frame_size - temporary_buffer.size(), input_size);
+                temporary_buffer.insert(temporary_buffer.cend(), input, input + offset);
+
+                if (temporary_buffer.size() == frame_size) {
+                    encode_frame(temporary_buffer.data(), packet.data(), temporary_capture_ns);
+                    temporary_buffer.clear();
+                }
             }
-            auto           remaining_data = capture_buffer.size();
-            std::ptrdiff_t idx = 0;
-            // process the remaining data if any and if its size more or equals to opus frame size
-            while (remaining_data >= kOpusFrameSize) {
-                int len = opus_encode_float(encoder, &capture_buffer[idx], kOpusFrameSize, packet.data(),
-                                            kPacketMaxSize);
-                if (len < 0 || len > kPacketMaxSize) return;
-                on_voice_input(packet.data(), len);
-                idx += kOpusFrameSize;
-                remaining_data -= kOpusFrameSize;
+            // encode whole frames straight from the input
+            while (input_size - offset >= frame_size) {
+                encode_frame(input + offset, packet.data(), sample_capture_ns(offset));
+                offset += frame_size;
             }
-            // add remaining data to the temporary buffer if any
-            if (remaining_data > 0) {
-                temporary_buffer.insert(temporary_buffer.cend(),
-                                        std::make_move_iterator(std::next(capture_buffer.begin(), idx)),
-                                        std::make_move_iterator(capture_buffer.end()));
-                capture_buffer.clear();
+            // keep the rest for the next buffer, temporary buffer has capacity of a frame
+            if (offset < input_size) {
+                temporary_capture_ns = sample_capture_ns(offset);
+                temporary_buffer.insert(temporary_buffer.cend(), input + offset, input + input_size);
             }
-
         }
 
         std::this_thread::sleep_for(sleep_time);
     }
+
+    if (thread_settings.lock_memory) {
+        for (const auto& [data, size] : locked_ranges) unlock_memory(data, size);
+    }
 }
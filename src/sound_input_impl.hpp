@@ -1,22 +1,53 @@
 #pragma once
 
 #include <cstdint>
+#include <chrono>
+#include <memory_resource>
 #include <mutex>
 #include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "frame_encoder.hpp"
+#include "kvoice.hpp"
+#include "resource_allocated.hpp"
+#include "ringbuffer.hpp"
+#include "sample_format.hpp"
 #include "sound_input.hpp"
+#include "thread_config.hpp"
+#include "wakeup_event.hpp"
 
-struct OpusEncoder;
 struct ALCdevice;
 
 namespace kvoice {
-constexpr auto kOpusFrameSize = 480;
-constexpr auto kPacketMaxSize = 32768;
+constexpr auto kPacketQueueSize = 64;
 
-class sound_input_impl final : public sound_input {
+class sound_input_impl final : public sound_input, public resource_allocated {
 public:
+    /**
+     * @brief Constructor
+     * @param device_name capture device name in UTF-8(empty for default)
+     * @param sample_rate opus encoder sampling rate
+     * @param frames_per_buffer count of device frames captured every tick
+     * @param bitrate opus encoder bitrate
+     * @param format format of captured samples
+     * @param device_rate capture device sampling rate, resampled to @p sample_rate before encoding
+     * @param packet_duration_ms duration of one encoded packet, 0 for one frame per packet
+     * @param frame_size samples per encoder frame, 0 for the @p profile default
+     * @param profile latency profile of the encoder and of capture reads
+     * @param thread scheduling parameters of the capture thread
+     * @param on_ready if set, device is open on the capture thread and the callback is called once it is,
+     * else device is open in the constructor
+     * @param resource resource of the encoder and of capture thread buffers
+     * @throws voice_exception if device couldn't be open, @p frame_size isn't a valid opus frame or
+     * @p packet_duration_ms isn't a multiple of frame
+     */
     sound_input_impl(std::string_view device_name, std::int32_t sample_rate, std::int32_t frames_per_buffer,
-                     std::uint32_t    bitrate);
+                     std::uint32_t    bitrate, sample_format format, std::int32_t device_rate,
+                     std::uint32_t    packet_duration_ms, std::uint32_t frame_size, latency_profile profile,
+                     const thread_config& thread, std::function<on_device_ready_t> on_ready,
+                     std::pmr::memory_resource* resource);
     ~sound_input_impl() override;
     bool enable_input() override;
     bool disable_input() override;
@@ -24,23 +55,82 @@ public:
     void change_device(std::string_view device_name) override;
     void set_input_callback(std::function<on_voice_input_t> cb) override;
     void set_raw_input_callback(std::function<on_voice_raw_input> cb) override;
+    void set_timed_input_callback(std::function<on_voice_timed_input_t> cb) override;
+
+    [[nodiscard]] input_stats   get_stats() const override;
+    [[nodiscard]] thread_report get_thread_report() const override;
+
+    void set_packet_log(packet_log_writer* writer, std::uint32_t stream_id) override;
+
+    void                          set_packet_queue_enabled(bool enabled) override;
+    bool                          try_pop(encoded_packet& packet) override;
+    std::size_t                   pop_batch(encoded_packet* packets, std::size_t max_count) override;
+    [[nodiscard]] wakeup_handle_t get_wakeup_handle() const override;
 private:
+    struct counters {
+        std::atomic<std::uint64_t> captured_samples{ 0 };
+        std::atomic<std::uint32_t> capture_backlog{ 0 };
+        std::atomic<std::uint64_t> overruns{ 0 };
+        std::atomic<std::uint64_t> encoded_packets{ 0 };
+        std::atomic<std::uint64_t> dropped_packets{ 0 };
+        std::atomic<std::uint64_t> encode_time_ns{ 0 };
+        std::atomic<std::uint64_t> queue_overflows{ 0 };
+    };
+
+    template <typename SampleT>
     void process_input();
+    void open_pending_device();
+    template <typename SampleT>
+    void encode_frame(const SampleT* frame, std::uint8_t* packet, std::int64_t capture_ns);
+    [[nodiscard]] std::int64_t capture_latency_ns();
 
     std::atomic<float>        input_gain{ 1.f };
     std::int32_t              sample_rate_{ 48000 };
+    std::int32_t              device_rate_{ 48000 };
     std::int32_t              frames_per_buffer_{ 420 };
-    std::chrono::milliseconds sleep_time{ 1000 };
+    // device frames read at once, a frame in the low latency profile
+    std::int32_t              read_frames_{ 420 };
+    sample_format             format_{ sample_format::float32 };
+    std::string               thread_name{};
+    thread_config             thread_settings{};
+    std::chrono::microseconds sleep_time{ 1000 };
+
+    std::pmr::memory_resource* resource{ nullptr };
 
-    OpusEncoder* encoder{ nullptr };
+    frame_encoder frame_coder;
 
     ALCdevice* input_device{ nullptr };
+    // device opened by the input thread, see create_sound_input_async
+    std::string                      pending_device{};
+    bool                             device_pending{ false };
+    std::function<on_device_ready_t> on_device_ready{};
 
     std::mutex  device_mutex;
+    // guards thread_state, written once by the input thread
+    mutable std::mutex report_mutex;
+    thread_report      thread_state{};
     std::thread input_thread;
 
     std::function<on_voice_input_t>   on_voice_input{};
     std::function<on_voice_raw_input> on_raw_voice_input{};
+    std::function<on_voice_timed_input_t> on_timed_voice_input{};
+
+    // alcGetInteger64vSOFT if ALC_SOFT_device_clock is supported
+    using get_integer64v_t = void (*)(ALCdevice* device, int param, int size, std::int64_t* values);
+    get_integer64v_t get_integer64v{ nullptr };
+    // capture time of the first sample of the packet being staged, in ns of steady_clock
+    std::int64_t packet_capture_ns{ 0 };
+
+    counters stats{};
+
+    std::atomic<packet_log_writer*> packet_log{ nullptr };
+    std::atomic<std::uint32_t>      packet_log_id{ 0 };
+
+    // encoded packets for pull-based delivery, written by the input thread
+    jnk0le::Ringbuffer<encoded_packet, kPacketQueueSize, false, kCacheLineSize> packet_queue{};
+    wakeup_event                                                                packet_event{};
+    std::atomic<bool>                                                           queue_enabled{ false };
+    std::uint32_t                                                               sequence{ 0 };
 
     bool input_active{ false };
     bool input_alive{ false };
@@ -3,49 +3,63 @@
 #include <AL/alext.h>
 #include "sound_output_impl.hpp"
 
+#include <algorithm>
+
+#include "gain_group_impl.hpp"
 #include "stream_impl.hpp"
 #include "voice_exception.hpp"
 
-kvoice::sound_output_impl::sound_output_impl(std::string_view device_name, std::uint32_t sample_rate, std::uint32_t src_count) : sampling_rate(sample_rate) {
-    using namespace std::string_literals;
-
-    device = alcOpenDevice(device_name.data());  // NOLINT(cppcoreguidelines-prefer-member-initializer)
+kvoice::sound_output_impl::sound_output_impl(std::string_view device_name, std::uint32_t sample_rate,
+                                             std::uint32_t    src_count, sample_format format, bool lock_memory,
+                                             std::uint32_t    hibernate_after_ms, std::uint32_t pool_size,
+                                             latency_profile  profile, std::uint32_t refresh_rate,
+                                             std::pmr::memory_resource* resource, spatial_table* shared_spatial)
+    : resource(resource),
+      sources(resource),
+      sampling_rate(sample_rate),
+      format(format),
+      lock_memory(lock_memory),
+      hibernate_after_ms(hibernate_after_ms),
+      profile(profile),
+      refresh_rate(refresh_rate != 0 || profile != latency_profile::low_latency ? refresh_rate
+                                                                                 : kLowLatencyRefreshRate),
+      max_pooled_buffers(static_cast<std::size_t>(pool_size) * kBuffersPerStream),
+      free_sources(resource),
+      pooled_buffers(resource),
+      float_storages(format == sample_format::float32 ? pool_size : 0, lock_memory, resource),
+      int16_storages(format == sample_format::int16 ? pool_size : 0, lock_memory, resource),
+      decoders(pool_size, resource),
+      own_spatial(resource),
+      spatial(shared_spatial ? shared_spatial : &own_spatial) {
+    pooled_buffers.reserve(max_pooled_buffers);
+    if (profile == latency_profile::low_latency) max_buffering_time = kLowLatencyMaxBufferingMs;
 
-    if (!device) throw voice_exception::create_formatted("Couldn't open device {}", device_name);
+    using namespace std::string_literals;
 
-    ctx = alcCreateContext(device, nullptr);
+    open_device(device_name, src_count);
 
-    if (!ctx || !alcMakeContextCurrent(ctx)) {
-        if (ctx) {
-            alcDestroyContext(ctx);
-        }
-        alcCloseDevice(device);
-        throw voice_exception("Couldn't set context");
-    }
     ALCint max_mono_sources;
 
     alcGetIntegerv(device, ALC_MONO_SOURCES, 1, &max_mono_sources);
 
     if (static_cast<ALCint>(src_count) > max_mono_sources) src_count = max_mono_sources;
 
-    sources = new std::uint32_t[src_count];
+    sources.resize(src_count);
 
-    alGenSources(static_cast<ALCint>(src_count), sources);
+    alGenSources(static_cast<ALCint>(src_count), sources.data());
 
     if (alGetError()) {
         throw voice_exception::create_formatted("Couldn't create {} sources", src_count);
     }
     this->src_count = src_count;
 
-    for (auto i = 0u; i < src_count; ++i) {
-        free_sources.push(sources[i]);
-    }
+    free_sources.assign(sources.begin(), sources.end());
 }
 
 kvoice::sound_output_impl::~sound_output_impl() {
+    delete_pooled_buffers();
 
-    alDeleteSources(static_cast<ALCint>(src_count), sources);
-    delete[] sources;
+    alDeleteSources(static_cast<ALCint>(src_count), sources.data());
 
     alcMakeContextCurrent(nullptr);
     alcDestroyContext(ctx);
@@ -81,70 +95,188 @@ void kvoice::sound_output_impl::update_me() {
 
 void kvoice::sound_output_impl::set_gain(float gain) noexcept {
     output_gain = gain;
+    alListenerf(AL_GAIN, output_gain);
 }
 
 void kvoice::sound_output_impl::change_device(std::string_view device_name) {
     drop_source_signal.emit();
 
-    while (!free_sources.empty()) {
-        free_sources.pop();
-    }
+    free_sources.clear();
+
+    // buffers belong to the device
+    delete_pooled_buffers();
 
-    alDeleteSources(static_cast<std::int32_t>(src_count), sources);
-    delete[] sources;
+    alDeleteSources(static_cast<std::int32_t>(src_count), sources.data());
 
     alcMakeContextCurrent(nullptr);
     alcDestroyContext(ctx);
     alcCloseDevice(device);
 
-    device = alcOpenDevice(device_name.data());  // NOLINT(cppcoreguidelines-prefer-member-initializer)
+    open_device(device_name, src_count);
+    alListenerf(AL_GAIN, output_gain);
 
-    if (!device) throw voice_exception::create_formatted("Couldn't open device {}", device_name);
-
-    ctx = alcCreateContext(device, nullptr);
-
-    if (!ctx || !alcMakeContextCurrent(ctx)) {
-        if (ctx) {
-            alcDestroyContext(ctx);
-        }
-        alcCloseDevice(device);
-        throw voice_exception("Couldn't set context");
-    }
     ALCint max_mono_sources;
 
     alcGetIntegerv(device, ALC_MONO_SOURCES, 1, &max_mono_sources);
 
     if (static_cast<ALCint>(src_count) > max_mono_sources) src_count = max_mono_sources;
 
-    sources = new std::uint32_t[src_count];
+    sources.resize(src_count);
 
-    alGenSources(static_cast<ALCint>(src_count), sources);
+    alGenSources(static_cast<ALCint>(src_count), sources.data());
 
     if (alGetError()) {
         throw voice_exception::create_formatted("Couldn't create {} sources", src_count);
     }
 
-    for (auto i = 0u; i < src_count; ++i) {
-        free_sources.push(sources[i]);
-    }
+    free_sources.assign(sources.begin(), sources.end());
 }
 
 std::uint32_t kvoice::sound_output_impl::get_source() {
     if (free_sources.empty()) throw voice_exception("There isn't free sources");
 
-    auto result = free_sources.front();
-    free_sources.pop();
+    auto result = free_sources.back();
+    free_sources.pop_back();
     return result;
 }
 
 void kvoice::sound_output_impl::free_source(std::uint32_t source) noexcept {
-    free_sources.push(source);
+    free_sources.push_back(source);
+}
+
+void kvoice::sound_output_impl::get_buffers(std::uint32_t* ids, std::size_t count) {
+    const std::size_t pooled = std::min(count, pooled_buffers.size());
+    std::copy(pooled_buffers.end() - static_cast<std::ptrdiff_t>(pooled), pooled_buffers.end(), ids);
+    pooled_buffers.resize(pooled_buffers.size() - pooled);
+
+    if (pooled == count) return;
+
+    alGenBuffers(static_cast<ALsizei>(count - pooled), ids + pooled);
+
+    ALenum errc;
+    if ((errc = alGetError()) != AL_NO_ERROR) {
+        free_buffers(ids, pooled);
+        throw voice_exception::create_formatted(
+            "Failed to create al buffers (errc = {})", errc);
+    }
+}
+
+void kvoice::sound_output_impl::free_buffers(const std::uint32_t* ids, std::size_t count) noexcept {
+    const std::size_t pooled = std::min(count, max_pooled_buffers - std::min(max_pooled_buffers,
+                                                                            pooled_buffers.size()));
+    pooled_buffers.insert(pooled_buffers.end(), ids, ids + pooled);
+
+    if (pooled < count)
+        alDeleteBuffers(static_cast<ALsizei>(count - pooled), ids + pooled);
+}
+
+void kvoice::sound_output_impl::delete_pooled_buffers() {
+    if (!pooled_buffers.empty())
+        alDeleteBuffers(static_cast<ALsizei>(pooled_buffers.size()), pooled_buffers.data());
+    pooled_buffers.clear();
 }
 
 void kvoice::sound_output_impl::set_buffering_time(std::uint32_t time_ms) {
-    buffering_time = time_ms;
+    set_buffering_bounds(time_ms, max_buffering_time);
+}
+
+void kvoice::sound_output_impl::set_buffering_bounds(std::uint32_t min_ms, std::uint32_t max_ms) {
+    min_buffering_time = min_ms;
+    max_buffering_time = std::max(min_ms, max_ms);
+}
+
+void kvoice::sound_output_impl::get_source_offset_latency(std::uint32_t source, double& offset_sec,
+                                                          double&       latency_sec) const {
+    if (get_source_dv) {
+        double values[2]{ 0.0, 0.0 };
+        get_source_dv(source, AL_SEC_OFFSET_LATENCY_SOFT, values);
+        offset_sec = values[0];
+        latency_sec = values[1];
+        return;
+    }
+
+    float offset = 0.f;
+    alGetSourcef(source, AL_SEC_OFFSET, &offset);
+    offset_sec = offset;
+    latency_sec = 0.0;
+}
+
+void kvoice::sound_output_impl::open_device(std::string_view device_name, std::uint32_t mono_sources) {
+    device = alcOpenDevice(device_name.data());
+
+    if (!device) throw voice_exception::create_formatted("Couldn't open device {}", device_name);
+
+    // ask for enough mono sources, default limit of OpenAL Soft is 256, refresh rate is passed only if set,
+    // otherwise its key is the terminator
+    const ALCint attrs[] = { ALC_MONO_SOURCES, static_cast<ALCint>(mono_sources),
+                             refresh_rate != 0 ? ALC_REFRESH : 0, static_cast<ALCint>(refresh_rate), 0 };
+    ctx = alcCreateContext(device, attrs);
+
+    if (!ctx || !alcMakeContextCurrent(ctx)) {
+        if (ctx) {
+            alcDestroyContext(ctx);
+        }
+        alcCloseDevice(device);
+        throw voice_exception("Couldn't set context");
+    }
+    query_extensions();
+}
+
+void kvoice::sound_output_impl::query_extensions() {
+    // new streams buffer at the device native rate, so OpenAL doesn't need to resample every source,
+    // existing streams keep their rate after device change
+    ALCint frequency = 0;
+    alcGetIntegerv(device, ALC_FREQUENCY, 1, &frequency);
+    device_rate = frequency > 0 ? static_cast<std::uint32_t>(frequency) : sampling_rate;
+
+    get_source_dv = nullptr;
+    if (alIsExtensionPresent("AL_SOFT_source_latency"))
+        get_source_dv = reinterpret_cast<get_source_dv_t>(alGetProcAddress("alGetSourcedvSOFT"));
 }
 
 std::unique_ptr<kvoice::stream> kvoice::sound_output_impl::create_stream() {
-    return std::make_unique<stream_impl>(this, sampling_rate);
+    return create_stream(sampling_rate);
+}
+
+std::unique_ptr<kvoice::stream> kvoice::sound_output_impl::create_stream(std::uint32_t sample_rate) {
+    return create_stream(sample_rate, spatial_table::kNoId);
+}
+
+std::unique_ptr<kvoice::stream> kvoice::sound_output_impl::create_stream(std::uint32_t sample_rate,
+                                                                         std::uint32_t spatial_id) {
+    if (format == sample_format::int16) {
+        return std::unique_ptr<stream>(
+            new (resource) stream_impl<std::int16_t>(this, sample_rate, device_rate, spatial_id));
+    }
+    return std::unique_ptr<stream>(new (resource) stream_impl<float>(this, sample_rate, device_rate, spatial_id));
+}
+
+void kvoice::sound_output_impl::set_positions(const std::uint32_t* ids, const float* xs, const float* ys,
+                                              const float* zs, std::size_t count) {
+    spatial->set_positions(ids, xs, ys, zs, count);
+}
+
+void kvoice::sound_output_impl::set_velocities(const std::uint32_t* ids, const float* xs, const float* ys,
+                                               const float* zs, std::size_t count) {
+    spatial->set_velocities(ids, xs, ys, zs, count);
+}
+
+void kvoice::sound_output_impl::set_directions(const std::uint32_t* ids, const float* xs, const float* ys,
+                                               const float* zs, std::size_t count) {
+    spatial->set_directions(ids, xs, ys, zs, count);
+}
+
+void kvoice::sound_output_impl::set_distances(const std::uint32_t* ids, const float* min_distances,
+                                              const float* max_distances, const float* rolloff_factors,
+                                              std::size_t count) {
+    spatial->set_distances(ids, min_distances, max_distances, rolloff_factors, count);
+}
+
+std::unique_ptr<kvoice::gain_group> kvoice::sound_output_impl::create_gain_group() {
+    return std::unique_ptr<gain_group>(new (resource) gain_group_impl(nullptr, gain_generation));
+}
+
+std::unique_ptr<kvoice::gain_group> kvoice::sound_output_impl::create_gain_group(gain_group& parent) {
+    return std::unique_ptr<gain_group>(
+        new (resource) gain_group_impl(static_cast<gain_group_impl*>(&parent), gain_generation));
 }
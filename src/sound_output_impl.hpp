@@ -1,22 +1,40 @@
 #pragma once
-#include <queue>
+#include <atomic>
+#include <type_traits>
+#include <vector>
 
+#include "latency_profile.hpp"
+#include "resource_allocated.hpp"
+#include "sample_format.hpp"
 #include "sound_output.hpp"
+#include "spatial_table.hpp"
+#include "stream_pool.hpp"
 #include "ktsignal/ktsignal.hpp"
 
 struct ALCdevice;
 struct ALCcontext;
 
 namespace kvoice {
-class sound_output_impl : public sound_output {
+class sound_output_impl : public sound_output, public resource_allocated {
 public:
     /**
      * @brief Constructor
      * @param device_name Output device name in UTF-8(empty for default)
-     * @param sample_rate Output device sampling rate
+     * @param sample_rate Default opus decoder sampling rate of streams
      * @param src_count Number of max sources
+     * @param format Format of samples in stream buffers
+     * @param lock_memory Lock stream buffers and rings in memory
+     * @param hibernate_after_ms Idle time after which streams hibernate, 0 to never hibernate
+     * @param pool_size Count of released stream resources kept for reuse
+     * @param profile Granularity of stream buffers and of the device mixing period
+     * @param refresh_rate Device mixing frequency(ALC_REFRESH), 0 for the profile default
+     * @param resource Resource of streams, their buffers and decoders
+     * @param shared_spatial Spatial table of streams created before the output, nullptr for own table
      */
-    sound_output_impl(std::string_view device_name, std::uint32_t sample_rate, std::uint32_t src_count);
+    sound_output_impl(std::string_view device_name, std::uint32_t sample_rate, std::uint32_t src_count,
+                      sample_format    format, bool lock_memory, std::uint32_t hibernate_after_ms,
+                      std::uint32_t    pool_size, latency_profile profile, std::uint32_t refresh_rate,
+                      std::pmr::memory_resource* resource, spatial_table* shared_spatial = nullptr);
     ~sound_output_impl() override;
 
     /**
@@ -64,30 +82,129 @@ public:
     std::uint32_t get_source();
     void          free_source(std::uint32_t source) noexcept;
 
+    /**
+     * @brief takes released OpenAL buffers, generates new ones if there aren't enough
+     * @param[out] ids buffer ids
+     * @param count count of buffers
+     * @throws voice_exception if buffers couldn't be generated
+     */
+    void get_buffers(std::uint32_t* ids, std::size_t count);
+    /**
+     * @brief returns unqueued OpenAL buffers to the pool, the ones exceeding pool size are deleted
+     */
+    void free_buffers(const std::uint32_t* ids, std::size_t count) noexcept;
+
     void set_buffering_time(std::uint32_t time_ms) override;
+    void set_buffering_bounds(std::uint32_t min_ms, std::uint32_t max_ms) override;
+
+    /**
+     * @brief queries source playback offset and device latency
+     * @details uses AL_SEC_OFFSET_LATENCY_SOFT if AL_SOFT_source_latency is present, else latency is 0
+     * @param source source handle
+     * @param[out] offset_sec playback offset in source queue, in seconds
+     * @param[out] latency_sec device output latency, in seconds
+     */
+    void get_source_offset_latency(std::uint32_t source, double& offset_sec, double& latency_sec) const;
 
     [[nodiscard]] float get_gain() const { return output_gain; }
 
-    [[nodiscard]] std::uint32_t get_buffering_time() const { return buffering_time; }
-    std::unique_ptr<stream>     create_stream() override;
+    [[nodiscard]] std::uint32_t get_min_buffering_time() const { return min_buffering_time; }
+    [[nodiscard]] std::uint32_t get_max_buffering_time() const { return max_buffering_time; }
+    [[nodiscard]] std::uint32_t get_device_rate() const { return device_rate; }
+    [[nodiscard]] bool          get_lock_memory() const { return lock_memory; }
+    [[nodiscard]] std::uint32_t get_hibernate_after() const { return hibernate_after_ms; }
+    [[nodiscard]] latency_profile get_latency_profile() const { return profile; }
+    [[nodiscard]] std::pmr::memory_resource* get_memory_resource() const { return resource; }
+
+    template <typename SampleT>
+    [[nodiscard]] storage_pool<SampleT>& get_storage_pool() {
+        if constexpr (std::is_same_v<SampleT, float>)
+            return float_storages;
+        else
+            return int16_storages;
+    }
+
+    [[nodiscard]] decoder_pool&  get_decoder_pool() { return decoders; }
+    [[nodiscard]] spatial_table& get_spatial_table() { return *spatial; }
+
+    std::unique_ptr<stream> create_stream() override;
+    std::unique_ptr<stream> create_stream(std::uint32_t sample_rate) override;
+    /**
+     * @brief creates stream on a row of the spatial table kept by the caller
+     * @param sample_rate opus decoder sampling rate
+     * @param spatial_id row of the spatial table, stays taken after the stream is destroyed
+     * @throws voice_exception if decoder couldn't be created
+     */
+    std::unique_ptr<stream> create_stream(std::uint32_t sample_rate, std::uint32_t spatial_id);
+
+    void set_positions(const std::uint32_t* ids, const float* xs, const float* ys, const float* zs,
+                       std::size_t count) override;
+    void set_velocities(const std::uint32_t* ids, const float* xs, const float* ys, const float* zs,
+                        std::size_t count) override;
+    void set_directions(const std::uint32_t* ids, const float* xs, const float* ys, const float* zs,
+                        std::size_t count) override;
+    void set_distances(const std::uint32_t* ids, const float* min_distances, const float* max_distances,
+                       const float* rolloff_factors, std::size_t count) override;
+
+    std::unique_ptr<gain_group> create_gain_group() override;
+    std::unique_ptr<gain_group> create_gain_group(gain_group& parent) override;
 
     ktsignal::ktsignal<void()> drop_source_signal;
 private:
+    // OpenAL buffers of one stream
+    static constexpr auto kBuffersPerStream = 16;
+    // mixing frequency and max adaptive buffering of the low latency profile
+    static constexpr auto kLowLatencyRefreshRate = 200;
+    static constexpr auto kLowLatencyMaxBufferingMs = 20;
+
+    /**
+     * @brief opens @p device_name and creates its context with mono sources and refresh rate attributes
+     * @throws voice_exception if device couldn't be open
+     */
+    void open_device(std::string_view device_name, std::uint32_t mono_sources);
+    void query_extensions();
+    void delete_pooled_buffers();
+
+    using get_source_dv_t = void (*)(std::uint32_t source, int param, double* values);
+
     vector listener_pos{ 0.f, 0.f, 0.f };
     vector listener_vel{ 0.f, 0.f, 0.f };
     vector listener_front{ 0.f, 0.f, 0.f };
     vector listener_up{ 0.f, 0.f, 0.f };
 
     float output_gain{ 1.f };
-
-    std::uint32_t* sources{ nullptr };
-    std::uint32_t  src_count{ 0 };
-    std::uint32_t  buffering_time{ 0 };
-    std::uint32_t  sampling_rate{ 0 };
-
-    std::queue<std::uint32_t> free_sources{};
+    // bumped by every change of any gain group of this output
+    std::atomic<std::uint32_t> gain_generation{ 0 };
+
+    std::pmr::memory_resource*      resource{ nullptr };
+    std::pmr::vector<std::uint32_t> sources;
+
+    std::uint32_t   src_count{ 0 };
+    std::uint32_t   min_buffering_time{ 0 };
+    std::uint32_t   max_buffering_time{ 200 };
+    std::uint32_t   sampling_rate{ 0 };
+    std::uint32_t   device_rate{ 0 };
+    sample_format   format{ sample_format::float32 };
+    bool            lock_memory{ false };
+    std::uint32_t   hibernate_after_ms{ 0 };
+    latency_profile profile{ latency_profile::standard };
+    std::uint32_t   refresh_rate{ 0 };
+    std::size_t     max_pooled_buffers{ 0 };
+
+    // stack of free sources, never grows past src_count
+    std::pmr::vector<std::uint32_t> free_sources;
+    std::pmr::vector<std::uint32_t> pooled_buffers;
+
+    storage_pool<float>        float_storages;
+    storage_pool<std::int16_t> int16_storages;
+    decoder_pool               decoders;
+
+    spatial_table  own_spatial;
+    spatial_table* spatial{ nullptr };
 
     ALCdevice*  device{ nullptr };
     ALCcontext* ctx{ nullptr };
+
+    get_source_dv_t get_source_dv{ nullptr };
 };
 } // namespace kvoice
@@ -0,0 +1,173 @@
+#include "spatial_table.hpp"
+
+#include <AL/alc.h>
+#include <AL/al.h>
+
+namespace {
+/**
+ * @brief writes @p values[i] to row @p ids[i] of @p column, unknown ids are skipped
+ */
+void scatter(std::pmr::vector<float>& column, const std::uint32_t* ids, const float* values, std::size_t count) {
+    float* const rows = column.data();
+    const auto   size = column.size();
+    for (std::size_t i = 0; i < count; ++i) {
+        if (ids[i] < size) rows[ids[i]] = values[i];
+    }
+}
+
+/**
+ * @brief defers OpenAL updates from the first change until destruction, so a batch is applied at once
+ */
+class deferred_updates {
+public:
+    deferred_updates() = default;
+    ~deferred_updates() {
+        if (ctx) alcProcessContext(ctx);
+    }
+
+    deferred_updates(const deferred_updates&) = delete;
+    deferred_updates& operator=(const deferred_updates&) = delete;
+
+    void begin() {
+        if (ctx) return;
+        ctx = alcGetCurrentContext();
+        if (ctx) alcSuspendContext(ctx);
+    }
+
+private:
+    ALCcontext* ctx{ nullptr };
+};
+}
+
+kvoice::spatial_table::spatial_table(std::pmr::memory_resource* resource)
+    : pos_x(resource),
+      pos_y(resource),
+      pos_z(resource),
+      vel_x(resource),
+      vel_y(resource),
+      vel_z(resource),
+      dir_x(resource),
+      dir_y(resource),
+      dir_z(resource),
+      min_distance(resource),
+      max_distance(resource),
+      rolloff_factor(resource),
+      sources(resource),
+      free_ids(resource) {
+}
+
+std::uint32_t kvoice::spatial_table::allocate() {
+    if (free_ids.empty()) {
+        // reserve free list along with the rows, so free never allocates
+        free_ids.reserve(sources.size() + 1);
+        for (auto* column : { &pos_x, &pos_y, &pos_z, &vel_x, &vel_y, &vel_z, &dir_x, &dir_y, &dir_z })
+            column->push_back(0.f);
+        min_distance.push_back(0.f);
+        max_distance.push_back(100.f);
+        rolloff_factor.push_back(1.f);
+        sources.push_back(0);
+        return static_cast<std::uint32_t>(sources.size() - 1);
+    }
+
+    const auto id = free_ids.back();
+    free_ids.pop_back();
+    pos_x[id] = pos_y[id] = pos_z[id] = 0.f;
+    vel_x[id] = vel_y[id] = vel_z[id] = 0.f;
+    dir_x[id] = dir_y[id] = dir_z[id] = 0.f;
+    min_distance[id] = 0.f;
+    max_distance[id] = 100.f;
+    rolloff_factor[id] = 1.f;
+    sources[id] = 0;
+    return id;
+}
+
+void kvoice::spatial_table::free(std::uint32_t id) noexcept {
+    sources[id] = 0;
+    free_ids.push_back(id);
+}
+
+void kvoice::spatial_table::set_position(std::uint32_t id, vector pos) {
+    set_vectors(AL_POSITION, pos_x, pos_y, pos_z, &id, &pos.x, &pos.y, &pos.z, 1);
+}
+
+void kvoice::spatial_table::set_velocity(std::uint32_t id, vector vel) {
+    set_vectors(AL_VELOCITY, vel_x, vel_y, vel_z, &id, &vel.x, &vel.y, &vel.z, 1);
+}
+
+void kvoice::spatial_table::set_direction(std::uint32_t id, vector dir) {
+    set_vectors(AL_DIRECTION, dir_x, dir_y, dir_z, &id, &dir.x, &dir.y, &dir.z, 1);
+}
+
+void kvoice::spatial_table::set_min_distance(std::uint32_t id, float distance) {
+    min_distance[id] = distance;
+    if (sources[id]) alSourcef(sources[id], AL_REFERENCE_DISTANCE, distance);
+}
+
+void kvoice::spatial_table::set_max_distance(std::uint32_t id, float distance) {
+    max_distance[id] = distance;
+    if (sources[id]) alSourcef(sources[id], AL_MAX_DISTANCE, distance);
+}
+
+void kvoice::spatial_table::set_rolloff_factor(std::uint32_t id, float rolloff) {
+    rolloff_factor[id] = rolloff;
+    if (sources[id]) alSourcef(sources[id], AL_ROLLOFF_FACTOR, rolloff);
+}
+
+void kvoice::spatial_table::set_positions(const std::uint32_t* ids, const float* xs, const float* ys,
+                                          const float* zs, std::size_t count) {
+    set_vectors(AL_POSITION, pos_x, pos_y, pos_z, ids, xs, ys, zs, count);
+}
+
+void kvoice::spatial_table::set_velocities(const std::uint32_t* ids, const float* xs, const float* ys,
+                                           const float* zs, std::size_t count) {
+    set_vectors(AL_VELOCITY, vel_x, vel_y, vel_z, ids, xs, ys, zs, count);
+}
+
+void kvoice::spatial_table::set_directions(const std::uint32_t* ids, const float* xs, const float* ys,
+                                           const float* zs, std::size_t count) {
+    set_vectors(AL_DIRECTION, dir_x, dir_y, dir_z, ids, xs, ys, zs, count);
+}
+
+void kvoice::spatial_table::set_distances(const std::uint32_t* ids, const float* min_distances,
+                                          const float* max_distances, const float* rolloff_factors,
+                                          std::size_t count) {
+    scatter(min_distance, ids, min_distances, count);
+    scatter(max_distance, ids, max_distances, count);
+    scatter(rolloff_factor, ids, rolloff_factors, count);
+
+    deferred_updates batch;
+    for (std::size_t i = 0; i < count; ++i) {
+        const auto id = ids[i];
+        if (id >= sources.size() || !sources[id]) continue;
+
+        batch.begin();
+        alSourcef(sources[id], AL_REFERENCE_DISTANCE, min_distance[id]);
+        alSourcef(sources[id], AL_MAX_DISTANCE, max_distance[id]);
+        alSourcef(sources[id], AL_ROLLOFF_FACTOR, rolloff_factor[id]);
+    }
+}
+
+void kvoice::spatial_table::set_vectors(int param, std::pmr::vector<float>& x, std::pmr::vector<float>& y,
+                                        std::pmr::vector<float>& z, const std::uint32_t* ids, const float* xs,
+                                        const float* ys, const float* zs, std::size_t count) {
+    // a column at a time, each pass writes to one contiguous column
+    scatter(x, ids, xs, count);
+    scatter(y, ids, ys, count);
+    scatter(z, ids, zs, count);
+
+    // a single change goes straight to OpenAL, suspending the context would only add two calls
+    if (count == 1) {
+        if (ids[0] < sources.size() && sources[ids[0]])
+            alSource3f(sources[ids[0]], param, x[ids[0]], y[ids[0]], z[ids[0]]);
+        return;
+    }
+
+    deferred_updates batch;
+    for (std::size_t i = 0; i < count; ++i) {
+        const auto id = ids[i];
+        if (id >= sources.size() || !sources[id]) continue;
+
+        batch.begin();
+        alSource3f(sources[id], param, x[id], y[id], z[id]);
+    }
+}
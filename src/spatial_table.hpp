@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+#include "kv_vector.hpp"
+
+namespace kvoice {
+/**
+ * @brief spatial parameters of every stream of an output, a column per coordinate
+ * @details stream id is a row of the table. Bulk setters scatter caller arrays into the columns and pass the
+ * rows with a live source to OpenAL in one deferred batch. Not thread safe, like the OpenAL calls it makes
+ */
+class spatial_table {
+public:
+    static constexpr std::uint32_t kNoId = 0xFFFFFFFF;
+
+    /**
+     * @brief Constructor
+     * @param resource resource of the columns
+     */
+    explicit spatial_table(std::pmr::memory_resource* resource);
+
+    /**
+     * @brief takes a row with default parameters, freed rows are reused first
+     * @return stream id
+     */
+    std::uint32_t allocate();
+    /**
+     * @brief returns row of destroyed stream
+     */
+    void free(std::uint32_t id) noexcept;
+
+    /**
+     * @brief sets OpenAL source that receives changes of the row, 0 for none
+     */
+    void set_source(std::uint32_t id, std::uint32_t source) noexcept { sources[id] = source; }
+
+    void set_position(std::uint32_t id, vector pos);
+    void set_velocity(std::uint32_t id, vector vel);
+    void set_direction(std::uint32_t id, vector dir);
+    void set_min_distance(std::uint32_t id, float distance);
+    void set_max_distance(std::uint32_t id, float distance);
+    void set_rolloff_factor(std::uint32_t id, float rolloff);
+
+    /**
+     * @brief sets positions of @p count streams, see @p sound_output::set_positions
+     */
+    void set_positions(const std::uint32_t* ids, const float* xs, const float* ys, const float* zs,
+                       std::size_t count);
+    void set_velocities(const std::uint32_t* ids, const float* xs, const float* ys, const float* zs,
+                        std::size_t count);
+    void set_directions(const std::uint32_t* ids, const float* xs, const float* ys, const float* zs,
+                        std::size_t count);
+    void set_distances(const std::uint32_t* ids, const float* min_distances, const float* max_distances,
+                       const float* rolloff_factors, std::size_t count);
+
+    [[nodiscard]] vector get_position(std::uint32_t id) const { return { pos_x[id], pos_y[id], pos_z[id] }; }
+    [[nodiscard]] vector get_velocity(std::uint32_t id) const { return { vel_x[id], vel_y[id], vel_z[id] }; }
+    [[nodiscard]] vector get_direction(std::uint32_t id) const { return { dir_x[id], dir_y[id], dir_z[id] }; }
+    [[nodiscard]] float  get_min_distance(std::uint32_t id) const { return min_distance[id]; }
+    [[nodiscard]] float  get_max_distance(std::uint32_t id) const { return max_distance[id]; }
+    [[nodiscard]] float  get_rolloff_factor(std::uint32_t id) const { return rolloff_factor[id]; }
+
+private:
+    /**
+     * @brief scatters @p xs, @p ys, @p zs into the columns and uploads rows with a live source as @p param
+     */
+    void set_vectors(int param, std::pmr::vector<float>& x, std::pmr::vector<float>& y, std::pmr::vector<float>& z,
+                     const std::uint32_t* ids, const float* xs, const float* ys, const float* zs,
+                     std::size_t count);
+
+    std::pmr::vector<float> pos_x;
+    std::pmr::vector<float> pos_y;
+    std::pmr::vector<float> pos_z;
+    std::pmr::vector<float> vel_x;
+    std::pmr::vector<float> vel_y;
+    std::pmr::vector<float> vel_z;
+    std::pmr::vector<float> dir_x;
+    std::pmr::vector<float> dir_y;
+    std::pmr::vector<float> dir_z;
+    std::pmr::vector<float> min_distance;
+    std::pmr::vector<float> max_distance;
+    std::pmr::vector<float> rolloff_factor;
+    // source of the row while its stream passes parameter changes to OpenAL, else 0
+    std::pmr::vector<std::uint32_t> sources;
+    // stack of free rows
+    std::pmr::vector<std::uint32_t> free_ids;
+};
+}
@@ -1,100 +1,370 @@
 #include "stream_impl.hpp"
 
+#include "packet_log.hpp"
+#include "sample_traits.hpp"
+#include "thread_utils.hpp"
+#include "tracing.hpp"
 #include "voice_exception.hpp"
+#include <algorithm>
+#include <cmath>
+#include <thread>
 #include <AL/alc.h>
 #include <AL/al.h>
 #include <AL/alext.h>
 #include <opus.h>
 
-kvoice::stream_impl::stream_impl(sound_output_impl* output, std::int32_t sample_rate)
-    : sample_rate(sample_rate),
+template <typename SampleT>
+kvoice::stream_impl<SampleT>::stream_impl(sound_output_impl* output, std::uint32_t codec_rate,
+                                          std::uint32_t      device_rate, std::uint32_t spatial_id)
+    : sample_rate(static_cast<std::int32_t>(device_rate)),
+      codec_rate(static_cast<std::int32_t>(codec_rate)),
+      spatial(&output->get_spatial_table()),
+      spatial_id(spatial_id),
+      rate_converter(codec_rate, device_rate, kOpusBufferSize, output->get_memory_resource()),
       output_impl(output),
       signal_connection(output->drop_source_signal.scoped_connect([this]() { if (has_source) drop_source(); })) {
-    alGenBuffers(kBuffersCount, buffers.data());
-
-    for (auto buffer : buffers) {
-        free_buffers.push(buffer);
+    // ring buffer and scratch buffers are locked by the pool if memory locking is enabled
+    storage = output->get_storage_pool<SampleT>().acquire();
+    try {
+        output->get_buffers(buffers.data(), kBuffersCount);
+        has_buffers = true;
+        decoder = output->get_decoder_pool().acquire(codec_rate);
+    } catch (voice_exception&) {
+        if (has_buffers) output->free_buffers(buffers.data(), kBuffersCount);
+        output->get_storage_pool<SampleT>().release(std::move(storage));
+        throw;
     }
 
-    ALenum errc;
-    if ((errc = alGetError()) != AL_NO_ERROR)
-        throw voice_exception::create_formatted(
-            "Failed to create al buffers (errc = {})", errc);
+    free_buffers = buffers;
+    free_buffer_count = kBuffersCount;
 
-    int opus_err;
-    decoder = opus_decoder_create(sample_rate, 1, &opus_err);
+    if (output->get_latency_profile() == latency_profile::low_latency) {
+        buffer_chunk_size = std::max<std::size_t>(1, device_rate / kLowLatencyChunkDivider);
+        max_queued_buffers = kLowLatencyBuffersCount;
+    }
 
-    if (opus_err != OPUS_OK || !decoder)
-        throw voice_exception::create_formatted(
-            "Failed to opus decoder (errc = {})", opus_err);
+    active_since_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    if (spatial_id == spatial_table::kNoId) {
+        this->spatial_id = spatial->allocate();
+        owns_spatial_id = true;
+    }
 }
 
-kvoice::stream_impl::~stream_impl() {
+template <typename SampleT>
+kvoice::stream_impl<SampleT>::~stream_impl() {
+    // stopped source returns queued buffers, so all of them can be pooled
     if (has_source)
-        output_impl->free_source(source);
-    alDeleteBuffers(kBuffersCount, buffers.data());
+        drop_source();
+    if (has_buffers)
+        output_impl->free_buffers(buffers.data(), kBuffersCount);
+    if (storage) {
+        // pooled storage is handed out empty
+        storage->ring.remove(storage->ring.readAvailable());
+        output_impl->get_storage_pool<SampleT>().release(std::move(storage));
+    }
+    if (decoder)
+        output_impl->get_decoder_pool().release(decoder, codec_rate);
+    if (owns_spatial_id)
+        spatial->free(spatial_id);
 }
 
-bool kvoice::stream_impl::push_opus_buffer(const void* data, std::size_t count) {
-    std::array<float, kOpusBufferSize> out{};
+template <typename SampleT>
+bool kvoice::stream_impl<SampleT>::begin_push() {
+    auto expected = hibernation_state::active;
+    while (!hibernation.compare_exchange_weak(expected, hibernation_state::pushing, std::memory_order_acq_rel)) {
+        if (expected == hibernation_state::hibernated) return wake();
+        // consumer is returning resources to the pools, that takes a few pool operations
+        if (expected == hibernation_state::hibernating) std::this_thread::yield();
+        expected = hibernation_state::active;
+    }
+    return true;
+}
 
-    const int frame_size = opus_decode_float(decoder, reinterpret_cast<const unsigned char*>(data),
-                                             static_cast<int>(count), out.data(),
-                                             kOpusBufferSize, 0);
-    if (frame_size < 0) return false;
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::end_push() {
+    hibernation.store(hibernation_state::active, std::memory_order_release);
+}
 
-    float final_gain = extra_gain * output_impl->get_gain();
-    if (final_gain != 1.f) {
-        std::transform(out.begin(), out.begin() + frame_size, out.begin(),
-                       [final_gain](float v) { return v * final_gain; });
+template <typename SampleT>
+bool kvoice::stream_impl<SampleT>::wake() {
+    // only the producer leaves hibernated state, consumer skips the stream until it is pushing
+    hibernation.store(hibernation_state::waking, std::memory_order_relaxed);
+
+    auto& storages = output_impl->get_storage_pool<SampleT>();
+    try {
+        storage = storages.acquire();
+        decoder = output_impl->get_decoder_pool().acquire(codec_rate);
+    } catch (const std::exception&) {
+        if (storage) storages.release(std::move(storage));
+        hibernation.store(hibernation_state::hibernated, std::memory_order_release);
+        return false;
     }
 
-    ring_buffer.writeBuff(out.data(), frame_size);
+    active_since_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    hibernation.store(hibernation_state::pushing, std::memory_order_release);
     return true;
 }
 
-void kvoice::stream_impl::set_position(vector pos) {
-    position = pos;
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::hibernate() {
+    auto expected = hibernation_state::active;
+    if (!hibernation.compare_exchange_strong(expected, hibernation_state::hibernating, std::memory_order_acq_rel))
+        return;
 
-    if (has_source && is_spatial)
-        alSourcefv(source, AL_POSITION, &position.x);
+    // push completed right before, play it first
+    if (!storage->ring.isEmpty()) {
+        hibernation.store(hibernation_state::active, std::memory_order_release);
+        return;
+    }
+
+    output_impl->get_storage_pool<SampleT>().release(std::move(storage));
+    output_impl->get_decoder_pool().release(decoder, codec_rate);
+    decoder = nullptr;
+    pcm_converter.reset();
+    pcm_rate = 0;
+    rate_converter.reset();
+
+    // source is already dropped, so every buffer is unqueued
+    output_impl->free_buffers(buffers.data(), kBuffersCount);
+    free_buffer_count = 0;
+    has_buffers = false;
+
+    hibernation.store(hibernation_state::hibernated, std::memory_order_release);
 }
 
-void kvoice::stream_impl::set_velocity(vector vel) {
-    velocity = vel;
+template <typename SampleT>
+bool kvoice::stream_impl<SampleT>::idle_expired() const {
+    const auto timeout_ms = output_impl->get_hibernate_after();
+    if (timeout_ms == 0) return false;
 
-    if (has_source && is_spatial)
-        alSourcefv(source, AL_VELOCITY, &velocity.x);
+    const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    const auto last_active = std::max(active_since_ns, arrivals.last_arrival_ns.load(std::memory_order_relaxed));
+    return now - last_active > static_cast<std::int64_t>(timeout_ms) * 1000000;
 }
 
-void kvoice::stream_impl::set_direction(vector dir) {
-    direction = dir;
+template <typename SampleT>
+bool kvoice::stream_impl<SampleT>::push_opus_buffer(const void* data, std::size_t count) {
+    const opus_packet packet{ data, count };
+    return push_opus_buffers(&packet, 1) == 1;
+}
 
-    if (has_source && is_spatial)
-        alSourcefv(source, AL_DIRECTION, &direction.x);
+template <typename SampleT>
+std::size_t kvoice::stream_impl<SampleT>::push_opus_buffers(const opus_packet* packets, std::size_t count) {
+    if (!begin_push()) return 0;
+
+    auto*      log = packet_log.load(std::memory_order_acquire);
+    const auto log_id = packet_log_id.load(std::memory_order_relaxed);
+
+    write_batch    batch{ storage->ring.peekWrite(kOpusBufferSize) };
+    std::size_t    decoded = 0;
+    latency_marker marker{};
+
+    auto decode_start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; ++i) {
+        if (log) log->record(log_id, packets[i].data, packets[i].size);
+
+        const auto written_before = batch.written;
+        const auto total_before = batch.total;
+        const bool packet_decoded = decode_packet(packets[i], batch);
+        if (packet_decoded) ++decoded;
+
+        // the first timestamped packet of the push that fully reached the ring is tracked until its first sample
+        // reaches the speaker, a marker of a failed or overrun packet would measure samples that were never played
+        if (!marker.capture_us && packets[i].capture_time_us && packet_decoded && batch.total > total_before &&
+            batch.written - written_before == batch.total - total_before) {
+            marker.position = write_total.load(std::memory_order_relaxed) + written_before;
+            marker.capture_us = packets[i].capture_time_us;
+            marker.push_us = static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(decode_start.time_since_epoch()).count());
+        }
+
+        const auto decode_end = std::chrono::steady_clock::now();
+        stats.decode_time_ns.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(decode_end - decode_start).count(),
+            std::memory_order_relaxed);
+        decode_start = decode_end;
+    }
+    flush_batch(batch);
+    write_total.store(write_total.load(std::memory_order_relaxed) + batch.written, std::memory_order_relaxed);
+    // marker is dropped if too many pushes are waiting for upload
+    if (marker.capture_us) latency_markers.insert(marker);
+    end_push();
+
+    if (batch.written < batch.total)
+        stats.overrun_samples.fetch_add(batch.total - batch.written, std::memory_order_relaxed);
+    if (batch.total)
+        track_arrival(static_cast<std::uint32_t>(batch.total));
+    return decoded;
 }
 
-void kvoice::stream_impl::set_min_distance(float distance) {
-    min_distance = distance;
+template <typename SampleT>
+bool kvoice::stream_impl<SampleT>::decode_packet(const opus_packet& packet, write_batch& batch) {
+    const auto* data = reinterpret_cast<const unsigned char*>(packet.data);
+    const auto  size = static_cast<opus_int32>(packet.size);
+    const int   packet_samples = opus_decoder_get_nb_samples(decoder, data, size);
+
+    // decode straight after already staged samples if the whole packet fits into the contiguous free region
+    // and doesn't need to be resampled
+    const bool        resample = !rate_converter.passthrough();
+    SampleT*          region = batch.spans.first + batch.staged;
+    const std::size_t region_size = batch.spans.first_size - batch.staged;
+    const bool        in_place = !resample && packet_samples > 0 &&
+                                 region_size >= static_cast<std::size_t>(packet_samples);
+
+    SampleT*  out = in_place ? region : storage->decode_buffer.data();
+    const int out_size = in_place ? static_cast<int>(std::min<std::size_t>(region_size, kOpusBufferSize))
+                                  : kOpusBufferSize;
+
+    int frame_size;
+    {
+        KVOICE_TRACE_SCOPE(opus_decode);
+        frame_size = traits::decode(decoder, data, static_cast<int>(size), out, out_size);
+    }
+    if (frame_size < 0) {
+        stats.decode_errors.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    stats.decoded_packets.fetch_add(1, std::memory_order_relaxed);
 
-    if (has_source && is_spatial)
-        alSourcef(source, AL_REFERENCE_DISTANCE, min_distance);
+    const auto frame_samples = static_cast<std::size_t>(frame_size);
+    if (in_place) {
+        batch.staged += frame_samples;
+        batch.total += frame_samples;
+        batch.written += frame_samples;
+        return true;
+    }
+
+    write_samples(out, frame_samples, resample ? &rate_converter : nullptr, batch);
+    return true;
 }
 
-void kvoice::stream_impl::set_max_distance(float distance) {
-    max_distance = distance;
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::write_samples(const SampleT* samples, std::size_t count, resampler* converter,
+                                                 write_batch& batch) {
+    if (!converter) {
+        flush_batch(batch);
+        KVOICE_TRACE_SCOPE(ring_write);
+        batch.total += count;
+        batch.written += storage->ring.writeBuff(samples, count);
+        batch.spans = storage->ring.peekWrite(kOpusBufferSize);
+        return;
+    }
 
-    if (has_source && is_spatial)
-        alSourcef(source, AL_MAX_DISTANCE, max_distance);
+    const std::size_t chunk = converter->max_input(storage->resample_buffer.size());
+    for (std::size_t offset = 0; offset < count; offset += chunk) {
+        const std::size_t in_count = std::min(chunk, count - offset);
+
+        // resample into the ring buffer if the worst case output fits, otherwise through the scratch buffer
+        if (batch.spans.first_size - batch.staged >= converter->max_output(in_count)) {
+            const auto produced = converter->process(samples + offset, in_count, batch.spans.first + batch.staged);
+            batch.staged += produced;
+            batch.total += produced;
+            batch.written += produced;
+        } else {
+            const auto produced = converter->process(samples + offset, in_count, storage->resample_buffer.data());
+            flush_batch(batch);
+            KVOICE_TRACE_SCOPE(ring_write);
+            batch.total += produced;
+            batch.written += storage->ring.writeBuff(storage->resample_buffer.data(), produced);
+            batch.spans = storage->ring.peekWrite(kOpusBufferSize);
+        }
+    }
 }
 
-void kvoice::stream_impl::set_rolloff_factor(float rolloff) {
-    rollof_factor = rolloff;
-    if (has_source && is_spatial)
-        alSourcef(source, AL_ROLLOFF_FACTOR, rollof_factor);
+template <typename SampleT>
+bool kvoice::stream_impl<SampleT>::push_pcm_buffer(const void* samples, std::size_t count, sample_format format,
+                                                   std::uint32_t rate) {
+    if (!begin_push()) return false;
+
+    resampler* converter = nullptr;
+    if (rate != static_cast<std::uint32_t>(sample_rate)) {
+        if (!pcm_converter || pcm_rate != rate) {
+            pcm_converter.emplace(rate, sample_rate, kOpusBufferSize, output_impl->get_memory_resource());
+            pcm_rate = rate;
+        }
+        converter = &*pcm_converter;
+    }
+
+    write_batch batch{ storage->ring.peekWrite(kOpusBufferSize) };
+
+    // gain is applied at playout, so samples already in the buffer format are resampled or copied as is
+    if (format == traits::kFormat)
+        write_samples(static_cast<const SampleT*>(samples), count, converter, batch);
+    else if (format == sample_format::int16)
+        convert_pcm(static_cast<const std::int16_t*>(samples), count, converter, batch);
+    else
+        convert_pcm(static_cast<const float*>(samples), count, converter, batch);
+    flush_batch(batch);
+    write_total.store(write_total.load(std::memory_order_relaxed) + batch.written, std::memory_order_relaxed);
+    end_push();
+
+    if (batch.written < batch.total)
+        stats.overrun_samples.fetch_add(batch.total - batch.written, std::memory_order_relaxed);
+    if (batch.total)
+        track_arrival(static_cast<std::uint32_t>(batch.total));
+    return batch.written == batch.total;
 }
 
-void kvoice::stream_impl::set_spatial_state(bool spatial_state) {
+template <typename SampleT>
+template <typename InputT>
+void kvoice::stream_impl<SampleT>::convert_pcm(const InputT* samples, std::size_t count, resampler* converter,
+                                               write_batch& batch) {
+    using input_traits = sample_traits<InputT>;
+
+    for (std::size_t offset = 0; offset < count; offset += kOpusBufferSize) {
+        const std::size_t chunk = std::min<std::size_t>(kOpusBufferSize, count - offset);
+        std::transform(samples + offset, samples + offset + chunk, storage->decode_buffer.begin(),
+                       [](InputT v) { return traits::from_float(input_traits::to_float(v)); });
+        write_samples(storage->decode_buffer.data(), chunk, converter, batch);
+    }
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::flush_batch(write_batch& batch) {
+    if (!batch.staged) return;
+
+    KVOICE_TRACE_SCOPE(ring_write);
+    storage->ring.commitWrite(batch.staged);
+    batch.spans = storage->ring.peekWrite(kOpusBufferSize);
+    batch.staged = 0;
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::set_position(vector pos) {
+    spatial->set_position(spatial_id, pos);
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::set_velocity(vector vel) {
+    spatial->set_velocity(spatial_id, vel);
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::set_direction(vector dir) {
+    spatial->set_direction(spatial_id, dir);
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::set_min_distance(float distance) {
+    spatial->set_min_distance(spatial_id, distance);
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::set_max_distance(float distance) {
+    spatial->set_max_distance(spatial_id, distance);
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::set_rolloff_factor(float rolloff) {
+    spatial->set_rolloff_factor(spatial_id, rolloff);
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::set_spatial_state(bool spatial_state) {
     if (this->is_spatial == spatial_state) return;
     if (!has_source) return;
 
@@ -102,18 +372,56 @@ void kvoice::stream_impl::set_spatial_state(bool spatial_state) {
     setup_spatial();
 }
 
-void kvoice::stream_impl::set_gain(float gain) {
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::set_gain(float gain) {
     output_gain = gain;
+    refresh_gain();
 }
 
-bool kvoice::stream_impl::is_playing() {
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::set_gain_group(gain_group* group) {
+    // every group is created by an output of this library
+    group_impl = static_cast<const gain_group_impl*>(group);
+    refresh_gain();
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::set_max_latency(std::uint32_t max_latency_ms, overflow_policy policy) {
+    max_latency_samples = static_cast<std::uint32_t>(static_cast<std::uint64_t>(max_latency_ms) * sample_rate / 1000);
+    latency_policy = policy;
+}
+
+template <typename SampleT>
+bool kvoice::stream_impl<SampleT>::is_playing() {
     return playing;
 }
 
-bool kvoice::stream_impl::update() {
+template <typename SampleT>
+bool kvoice::stream_impl<SampleT>::update() {
+    // resources of hibernated stream belong to the pools, waking stream is being filled by the producer
+    const auto current = hibernation.load(std::memory_order_acquire);
+    if (current == hibernation_state::hibernated || current == hibernation_state::waking)
+        return true;
+
+    if (!has_buffers) {
+        try {
+            output_impl->get_buffers(buffers.data(), kBuffersCount);
+        } catch (voice_exception&) {
+            return false;
+        }
+        free_buffers = buffers;
+        free_buffer_count = kBuffersCount;
+        has_buffers = true;
+    }
+
+    if (group_impl && group_impl->get_generation() != group_generation)
+        refresh_gain();
+
     if (!has_source) {
-        if (ring_buffer.isEmpty())
+        if (storage->ring.isEmpty()) {
+            if (idle_expired()) hibernate();
             return true;
+        }
 
         try {
             source = output_impl->get_source();
@@ -122,9 +430,9 @@ bool kvoice::stream_impl::update() {
         }
 
         has_source = true;
-        last_source_request_time = std::chrono::steady_clock::now();
 
         source_used_once = false;
+        underrun_counted = false;
 
         try {
             update_source(source);
@@ -149,19 +457,20 @@ bool kvoice::stream_impl::update() {
         return false;
     }
 
-    if (ring_buffer.isEmpty() && !playing && source_used_once) {
-        while (processed > 0) {
-            ALuint bufid;
-            alSourceUnqueueBuffers(source, 1, &bufid);
-            free_buffers.push(bufid);
-            processed--;
-        }
+    if (storage->ring.isEmpty() && !playing && source_used_once) {
+        unqueue_processed(processed);
 
         drop_source();
         return true;
     }
 
-    if (ring_buffer.readAvailable() >= kRingBufferSize / 2)
+    // stopped source waits for the buffering target, the underrun is counted once for the whole rebuffer
+    if (state == AL_STOPPED && source_used_once && !underrun_counted) {
+        stats.underruns.fetch_add(1, std::memory_order_relaxed);
+        underrun_counted = true;
+    }
+
+    if (storage->ring.readAvailable() >= kRingBufferSize / 2)
         alSourcef(source, AL_PITCH, 1.05f);
     else
         alSourcef(source, AL_PITCH, 1.f);
@@ -171,52 +480,121 @@ bool kvoice::stream_impl::update() {
         return false;
     }
 
-    while (processed > 0) {
-        ALuint bufid;
-        alSourceUnqueueBuffers(source, 1, &bufid);
-        free_buffers.push(bufid);
-        processed--;
-    }
+    unqueue_processed(processed);
+    enforce_max_latency();
 
-    while (!ring_buffer.isEmpty() && !free_buffers.empty()) {
-        std::array<float, 4096> temp_buffer{};
-        const std::uint32_t     buffer_id = free_buffers.front();
-        free_buffers.pop();
+    while (free_buffer_count > kBuffersCount - max_queued_buffers) {
+        typename ring_buffer_t::Spans spans;
+        {
+            KVOICE_TRACE_SCOPE(ring_read);
+            spans = storage->ring.peekRead(buffer_chunk_size);
+        }
 
-        if (const std::size_t readed = ring_buffer.readBuff(temp_buffer.data(), temp_buffer.size()); readed > 0) {
-            alBufferData(buffer_id, AL_FORMAT_MONO_FLOAT32, temp_buffer.data(),
-                         static_cast<int>(readed * sizeof(float)), sample_rate);
-            if (alGetError() != AL_NO_ERROR) {
-                drop_source();
-                return false;
-            }
+        // upload straight from the ring buffer, wrapped around part goes to the next buffer
+        const std::size_t readed = std::min(spans.first_size, buffer_chunk_size);
+        if (readed == 0) break;
 
-            alSourceQueueBuffers(source, 1, &buffer_id);
-            if (alGetError() != AL_NO_ERROR) {
-                drop_source();
-                return false;
-            }
-        } else
-            break;
+        const std::uint32_t buffer_id = free_buffers[--free_buffer_count];
+
+        {
+            KVOICE_TRACE_SCOPE(buffer_data);
+            alBufferData(buffer_id, traits::kAlFormat, spans.first,
+                         static_cast<int>(readed * sizeof(SampleT)), sample_rate);
+        }
+        if (alGetError() != AL_NO_ERROR) {
+            free_buffers[free_buffer_count++] = buffer_id;
+            drop_source();
+            return false;
+        }
+        storage->ring.commitRead(readed);
+        consume_latency_markers(readed, marker_state::queued);
+
+        alSourceQueueBuffers(source, 1, &buffer_id);
+        if (alGetError() != AL_NO_ERROR) {
+            free_buffers[free_buffer_count++] = buffer_id;
+            drop_source();
+            return false;
+        }
+
+        const auto idx = std::distance(buffers.begin(), std::find(buffers.begin(), buffers.end(), buffer_id));
+        buffer_samples[idx] = static_cast<std::uint32_t>(readed);
+        stats.queued_samples.fetch_add(static_cast<std::uint32_t>(readed), std::memory_order_relaxed);
     }
 
     if (!playing) {
-        auto ctime = std::chrono::steady_clock::now();
-        auto time_from_first_buffer = std::chrono::duration_cast<std::chrono::milliseconds>(
-            ctime - last_source_request_time).count();
-        if (time_from_first_buffer > output_impl->get_buffering_time()) {
+        const auto buffered = storage->ring.readAvailable() + stats.queued_samples.load(std::memory_order_relaxed);
+        // short talk spurts may never reach the target, so play whatever there is once packets stop coming
+        if (buffered >= target_buffered_samples() || arrivals_stalled()) {
             alSourcePlay(source);
             source_used_once = true;
+            underrun_counted = false;
             if (alGetError() != AL_NO_ERROR) {
                 drop_source();
                 return false;
             }
         }
     }
+
+    update_latency();
     return true;
 }
 
-void kvoice::stream_impl::setup_spatial() const {
+template <typename SampleT>
+kvoice::stream_stats kvoice::stream_impl<SampleT>::get_stats() const {
+    stream_stats result;
+
+    // ring buffer may be released by hibernation meanwhile, so it isn't touched here
+    const auto written = write_total.load(std::memory_order_relaxed);
+    const auto read = read_total.load(std::memory_order_relaxed);
+    const auto ring_samples = static_cast<std::uint32_t>(written > read ? written - read : 0);
+    const auto queued = stats.queued_samples.load(std::memory_order_relaxed);
+    const auto decoded = stats.decoded_packets.load(std::memory_order_relaxed);
+
+    result.buffered_samples = ring_samples;
+    result.buffered_ms = static_cast<float>(ring_samples + queued) * 1000.f / static_cast<float>(sample_rate);
+    result.playback_latency_ms = stats.playback_latency_ms.load(std::memory_order_relaxed);
+    result.target_buffer_ms = static_cast<float>(target_buffered_samples()) * 1000.f / static_cast<float>(sample_rate);
+    result.arrival_jitter_ms = arrivals.jitter_ms.load(std::memory_order_relaxed);
+    result.underruns = stats.underruns.load(std::memory_order_relaxed);
+    result.overrun_samples = stats.overrun_samples.load(std::memory_order_relaxed);
+    result.discarded_samples = stats.discarded_samples.load(std::memory_order_relaxed);
+    result.discarded_silence_samples = stats.discarded_silence_samples.load(std::memory_order_relaxed);
+    result.decoded_packets = decoded;
+    result.decode_errors = stats.decode_errors.load(std::memory_order_relaxed);
+    if (decoded > 0) {
+        result.avg_decode_time_us = static_cast<float>(stats.decode_time_ns.load(std::memory_order_relaxed)) /
+                                    static_cast<float>(decoded) / 1000.f;
+    }
+    result.capture_to_push_ms = stats.capture_to_push_ms.load(std::memory_order_relaxed);
+    result.push_to_playout_ms = stats.push_to_playout_ms.load(std::memory_order_relaxed);
+    result.capture_to_playout_ms = stats.capture_to_playout_ms.load(std::memory_order_relaxed);
+    result.latency_samples = stats.latency_samples.load(std::memory_order_relaxed);
+    return result;
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::set_packet_log(packet_log_writer* writer, std::uint32_t stream_id) {
+    packet_log_id.store(stream_id, std::memory_order_relaxed);
+    packet_log.store(writer, std::memory_order_release);
+}
+
+template <typename SampleT>
+std::uint32_t kvoice::stream_impl<SampleT>::get_id() const {
+    return spatial_id;
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::refresh_gain() {
+    // generation is read before the groups, a change made during the walk is picked up by the next update
+    group_generation = group_impl ? group_impl->get_generation() : 0;
+    applied_gain = output_gain * (group_impl ? group_impl->get_effective_gain() : 1.f);
+
+    if (has_source)
+        alSourcef(source, AL_GAIN, applied_gain);
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::setup_spatial() const {
     if (this->is_spatial) {
         vector zeros{ 0.f, 0.f, 0.f };
 
@@ -228,22 +606,29 @@ void kvoice::stream_impl::setup_spatial() const {
         alSourcef(source, AL_ROLLOFF_FACTOR, 1.f);
         alSourcei(source, AL_SOURCE_RELATIVE, AL_TRUE);
     } else {
+        const auto position = spatial->get_position(spatial_id);
+        const auto velocity = spatial->get_velocity(spatial_id);
+        const auto direction = spatial->get_direction(spatial_id);
         alSourcefv(source, AL_POSITION, &position.x);
         alSourcefv(source, AL_VELOCITY, &velocity.x);
         alSourcefv(source, AL_DIRECTION, &direction.x);
-        alSourcef(source, AL_MAX_DISTANCE, max_distance);
-        alSourcef(source, AL_REFERENCE_DISTANCE, min_distance);
-        alSourcef(source, AL_ROLLOFF_FACTOR, rollof_factor);
+        alSourcef(source, AL_MAX_DISTANCE, spatial->get_max_distance(spatial_id));
+        alSourcef(source, AL_REFERENCE_DISTANCE, spatial->get_min_distance(spatial_id));
+        alSourcef(source, AL_ROLLOFF_FACTOR, spatial->get_rolloff_factor(spatial_id));
         alSourcei(source, AL_SOURCE_RELATIVE, AL_FALSE);
     }
+    // setters pass changes to the source only while it is spatial
+    spatial->set_source(spatial_id, is_spatial ? source : 0);
 }
 
-void kvoice::stream_impl::update_source(std::uint32_t source_handle) const {
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::update_source(std::uint32_t source_handle) const {
     alSourceRewind(source_handle);
 
     alSourcei(source_handle, AL_LOOPING, false);
     alSourcei(source_handle, AL_BUFFER, 0);
 
+    alSourcef(source_handle, AL_GAIN, applied_gain);
     setup_spatial();
 
     ALenum errc;
@@ -252,11 +637,239 @@ void kvoice::stream_impl::update_source(std::uint32_t source_handle) const {
             "failed to update source (last errc = {})", errc);
 }
 
-void kvoice::stream_impl::drop_source() {
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::drop_source() {
     if (has_source) {
         alSourceStop(source);
+
+        // stopped source marks all queued buffers as processed
+        std::int32_t processed = 0;
+        alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
+        unqueue_processed(processed);
+
+        // queued audio that wasn't played is gone
+        while (auto* marker = latency_markers.peek()) {
+            if (marker->state == marker_state::buffered) break;
+            latency_markers.remove();
+        }
+
         output_impl->free_source(source);
+        spatial->set_source(spatial_id, 0);
 
         has_source = false;
     }
 }
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::unqueue_processed(std::int32_t processed) {
+    while (processed > 0) {
+        ALuint bufid;
+        alSourceUnqueueBuffers(source, 1, &bufid);
+        free_buffers[free_buffer_count++] = bufid;
+
+        const auto idx = std::distance(buffers.begin(), std::find(buffers.begin(), buffers.end(), bufid));
+        if (idx < kBuffersCount) {
+            stats.queued_samples.fetch_sub(buffer_samples[idx], std::memory_order_relaxed);
+            dequeued_total += buffer_samples[idx];
+            buffer_samples[idx] = 0;
+        }
+        processed--;
+    }
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::update_latency() {
+    double offset_sec, latency_sec;
+    output_impl->get_source_offset_latency(source, offset_sec, latency_sec);
+
+    const double queued_sec = static_cast<double>(stats.queued_samples.load(std::memory_order_relaxed)) /
+                              static_cast<double>(sample_rate);
+    const double remaining_sec = queued_sec > offset_sec ? queued_sec - offset_sec : 0.0;
+
+    stats.playback_latency_ms.store(static_cast<float>((remaining_sec + latency_sec) * 1000.0),
+                                    std::memory_order_relaxed);
+
+    // source offset doesn't move until playback starts
+    if (playing) resolve_latency_markers(offset_sec, latency_sec);
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::consume_latency_markers(std::size_t count, marker_state state) {
+    const std::uint64_t begin = read_total.load(std::memory_order_relaxed);
+    const std::uint64_t end = begin + count;
+
+    for (std::size_t i = 0, size = latency_markers.readAvailable(); i < size; ++i) {
+        auto& marker = latency_markers[i];
+        if (marker.position >= end) break;
+        if (marker.state != marker_state::buffered) continue;
+
+        marker.state = state;
+        marker.queue_position = uploaded_total + (marker.position - begin);
+    }
+
+    read_total.store(end, std::memory_order_relaxed);
+    if (state == marker_state::queued) uploaded_total += count;
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::resolve_latency_markers(double offset_sec, double latency_sec) {
+    const auto now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    // position of the sample being played now, offset is relative to the oldest queued buffer
+    const double played = static_cast<double>(dequeued_total) + offset_sec * static_cast<double>(sample_rate);
+
+    while (auto* marker = latency_markers.peek()) {
+        if (marker->state == marker_state::buffered) break;
+
+        if (marker->state == marker_state::queued) {
+            const double until_played_sec = std::max(
+                0.0, (static_cast<double>(marker->queue_position) - played) / static_cast<double>(sample_rate));
+            const double playout_us = static_cast<double>(now_us) + (until_played_sec + latency_sec) * 1e6;
+            const auto   capture_us = static_cast<double>(marker->capture_us);
+            const auto   push_us = static_cast<double>(marker->push_us);
+
+            stats.capture_to_push_ms.store(static_cast<float>((push_us - capture_us) / 1000.0),
+                                           std::memory_order_relaxed);
+            stats.push_to_playout_ms.store(static_cast<float>((playout_us - push_us) / 1000.0),
+                                           std::memory_order_relaxed);
+            stats.capture_to_playout_ms.store(static_cast<float>((playout_us - capture_us) / 1000.0),
+                                              std::memory_order_relaxed);
+            stats.latency_samples.fetch_add(1, std::memory_order_relaxed);
+        }
+        latency_markers.remove();
+    }
+}
+
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::enforce_max_latency() {
+    if (latency_policy == overflow_policy::none || max_latency_samples == 0) return;
+
+    const std::size_t queued = stats.queued_samples.load(std::memory_order_relaxed);
+    const std::size_t budget = max_latency_samples > queued ? max_latency_samples - queued : 0;
+    const std::size_t buffered = storage->ring.readAvailable();
+    if (buffered <= budget) return;
+
+    const std::size_t excess = buffered - budget;
+    std::size_t       discarded = 0;
+
+    switch (latency_policy) {
+    case overflow_policy::drop_oldest:
+        discarded = storage->ring.remove(excess);
+        break;
+    case overflow_policy::skip_to_newest: {
+        // leave some headroom, so the next burst doesn't cause another cut right away
+        const std::size_t keep = std::min(budget, static_cast<std::size_t>(max_latency_samples / 2));
+        skip_to_newest(buffered, keep);
+        discarded = buffered - keep;
+        break;
+    }
+    case overflow_policy::compress_silence: {
+        const std::size_t silence = remove_silence(buffered, excess);
+        stats.discarded_silence_samples.fetch_add(silence, std::memory_order_relaxed);
+        discarded = silence + storage->ring.remove(excess - silence);
+        break;
+    }
+    default:
+        break;
+    }
+    consume_latency_markers(discarded, marker_state::discarded);
+
+    stats.discarded_samples.fetch_add(discarded, std::memory_order_relaxed);
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::skip_to_newest(std::size_t buffered, std::size_t keep) {
+    const std::size_t skip = buffered - keep;
+    const std::size_t fade = std::min({ keep, skip, static_cast<std::size_t>(sample_rate / kCrossfadeDivider) });
+
+    // fade from the audio that would have been played next into the kept audio
+    for (std::size_t i = 0; i < fade; ++i) {
+        const float weight = static_cast<float>(i + 1) / static_cast<float>(fade + 1);
+        storage->ring[skip + i] = traits::from_float(traits::to_float(storage->ring[i]) * (1.f - weight) +
+                                                   traits::to_float(storage->ring[skip + i]) * weight);
+    }
+
+    storage->ring.remove(skip);
+}
+
+template <typename SampleT>
+std::size_t kvoice::stream_impl<SampleT>::remove_silence(std::size_t buffered, std::size_t excess) {
+    const std::size_t block = sample_rate / kSilenceBlockDivider;
+    if (block == 0) return 0;
+
+    // walk blocks from the newest to the oldest one, shifting kept audio towards the newest end,
+    // so the removed part ends up at the ring tail and can be dropped
+    std::size_t removed = 0;
+    std::size_t end = buffered;
+    while (end >= block) {
+        const std::size_t begin = end - block;
+
+        bool silent = removed + block <= excess;
+        for (std::size_t i = begin; silent && i < end; ++i) {
+            silent = std::abs(traits::to_float(storage->ring[i])) < kSilenceThreshold;
+        }
+
+        if (silent) {
+            removed += block;
+        } else if (removed > 0) {
+            for (std::size_t i = end; i > begin; --i) storage->ring[i - 1 + removed] = storage->ring[i - 1];
+        }
+        end = begin;
+    }
+
+    if (removed == 0) return 0;
+
+    // shift the oldest partial block as well
+    for (std::size_t i = end; i > 0; --i) storage->ring[i - 1 + removed] = storage->ring[i - 1];
+
+    return storage->ring.remove(removed);
+}
+
+template <typename SampleT>
+void kvoice::stream_impl<SampleT>::track_arrival(std::uint32_t packet_samples) {
+    const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    const auto last = arrivals.last_arrival_ns.exchange(now, std::memory_order_relaxed);
+    const auto last_samples = arrivals.last_packet_samples.exchange(packet_samples, std::memory_order_relaxed);
+
+    if (last == 0) return;
+
+    const float interval_ms = static_cast<float>(now - last) / 1e6f;
+    // gap between talk spurts isn't a jitter
+    if (interval_ms > static_cast<float>(kTalkSpurtGapMs)) return;
+
+    const float expected_ms = static_cast<float>(last_samples) * 1000.f / static_cast<float>(sample_rate);
+    const float deviation = std::abs(interval_ms - expected_ms);
+    const float jitter = arrivals.jitter_ms.load(std::memory_order_relaxed);
+
+    arrivals.jitter_ms.store(jitter + (deviation - jitter) * kJitterSmoothing, std::memory_order_relaxed);
+}
+
+template <typename SampleT>
+std::uint32_t kvoice::stream_impl<SampleT>::target_buffered_samples() const {
+    const float packet_ms = static_cast<float>(arrivals.last_packet_samples.load(std::memory_order_relaxed)) *
+                            1000.f / static_cast<float>(sample_rate);
+    const float jitter_ms = arrivals.jitter_ms.load(std::memory_order_relaxed);
+    const float target_ms = std::clamp(packet_ms + kJitterMultiplier * jitter_ms,
+                                       static_cast<float>(output_impl->get_min_buffering_time()),
+                                       static_cast<float>(output_impl->get_max_buffering_time()));
+
+    return static_cast<std::uint32_t>(target_ms * static_cast<float>(sample_rate) / 1000.f);
+}
+
+template <typename SampleT>
+bool kvoice::stream_impl<SampleT>::arrivals_stalled() const {
+    const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    const auto since_last_ms = (now - arrivals.last_arrival_ns.load(std::memory_order_relaxed)) / 1000000;
+    const auto packet_ms = static_cast<std::int64_t>(arrivals.last_packet_samples.load(std::memory_order_relaxed)) *
+                           1000 / sample_rate;
+
+    const auto jitter_ms = static_cast<std::int64_t>(arrivals.jitter_ms.load(std::memory_order_relaxed));
+
+    return since_last_ms > 2 * packet_ms + static_cast<std::int64_t>(kJitterMultiplier) * jitter_ms;
+}
+
+template class kvoice::stream_impl<float>;
+template class kvoice::stream_impl<std::int16_t>;
@@ -2,32 +2,77 @@
 
 #include <cstdint>
 #include <array>
+#include <atomic>
 #include <chrono>
-#include <queue>
+#include <memory>
+#include <optional>
 
+#include "gain_group_impl.hpp"
+#include "resampler.hpp"
 #include "ringbuffer.hpp"
 #include "sound_output_impl.hpp"
+#include "spatial_table.hpp"
+#include "stream_pool.hpp"
 #include "kv_vector.hpp"
 #include "stream.hpp"
 
 struct OpusDecoder;
 
 namespace kvoice {
-class stream_impl final : public stream {
+template <typename SampleT>
+struct sample_traits;
+
+/**
+ * @brief stream pipeline with samples of type @p SampleT in ring buffer and OpenAL buffers
+ * @tparam SampleT float or std::int16_t, instantiated in stream_impl.cpp
+ */
+template <typename SampleT>
+class stream_impl final : public stream, public resource_allocated {
+    using traits = sample_traits<SampleT>;
+
     static void _foo() {
     }
 
     using sconnection_t = decltype(sound_output_impl::drop_source_signal.scoped_connect(&_foo));
 
+    using storage_t = stream_storage<SampleT>;
+    using ring_buffer_t = typename storage_t::ring_buffer_t;
+
     static constexpr auto kBuffersCount = 16;
     static constexpr auto kMinBuffersCount = 8;
-    static constexpr auto kRingBufferSize = 262144;
-    static constexpr auto kOpusBufferSize = 8196;
+    static constexpr auto kRingBufferSize = storage_t::kRingBufferSize;
+    static constexpr auto kOpusBufferSize = storage_t::kOpusBufferSize;
+    static constexpr auto kBufferChunkSize = 4096;
+    // low latency profile queues up to 4 buffers of 5 ms
+    static constexpr auto kLowLatencyBuffersCount = 4;
+    static constexpr auto kLowLatencyChunkDivider = 200;
+    // crossfade and silence detection granularity, in fractions of a second
+    static constexpr auto kCrossfadeDivider = 200;
+    static constexpr auto kSilenceBlockDivider = 100;
+    static constexpr auto kSilenceThreshold = 0.01f;
+    // arrival jitter estimation, see RFC 3550 6.4.1
+    static constexpr auto kJitterSmoothing = 1.f / 16.f;
+    static constexpr auto kJitterMultiplier = 3.f;
+    static constexpr auto kTalkSpurtGapMs = 500;
+    // timestamped packets waiting for their first sample to be uploaded, one per push
+    static constexpr auto kLatencyMarkersSize = 64;
 public:
-    stream_impl(sound_output_impl* output, std::int32_t sample_rate);
+    /**
+     * @brief Constructor
+     * @param output owning output
+     * @param codec_rate opus decoder sampling rate
+     * @param device_rate sampling rate of buffered and uploaded audio
+     * @param spatial_id row of the output spatial table kept by the caller, spatial_table::kNoId to take a row
+     * for the stream lifetime
+     */
+    stream_impl(sound_output_impl* output, std::uint32_t codec_rate, std::uint32_t device_rate,
+                std::uint32_t spatial_id);
     ~stream_impl() override;
 
-    bool push_opus_buffer(const void* data, std::size_t count) override;
+    bool        push_opus_buffer(const void* data, std::size_t count) override;
+    std::size_t push_opus_buffers(const opus_packet* packets, std::size_t count) override;
+    bool        push_pcm_buffer(const void* samples, std::size_t count, sample_format format,
+                                std::uint32_t sample_rate) override;
 
     void set_position(vector pos) override;
     void set_velocity(vector vel) override;
@@ -37,42 +82,167 @@ public:
     void set_rolloff_factor(float rolloff) override;
     void set_spatial_state(bool spatial_state) override;
     void set_gain(float gain) override;
+    void set_gain_group(gain_group* group) override;
+    void set_max_latency(std::uint32_t max_latency_ms, overflow_policy policy) override;
 
     bool is_playing() override;
 
     bool update() override;
 
+    [[nodiscard]] stream_stats get_stats() const override;
+
+    void set_packet_log(packet_log_writer* writer, std::uint32_t stream_id) override;
+
+    [[nodiscard]] std::uint32_t get_id() const override;
+
 private:
+    // producer marks pushes, consumer marks release of resources, the stream is owned by one of them at a time
+    enum class hibernation_state : std::uint8_t {
+        active,
+        pushing,
+        hibernating,
+        hibernated,
+        waking
+    };
+
+    struct counters {
+        std::atomic<std::uint64_t> underruns{ 0 };
+        std::atomic<std::uint64_t> overrun_samples{ 0 };
+        std::atomic<std::uint64_t> discarded_samples{ 0 };
+        std::atomic<std::uint64_t> discarded_silence_samples{ 0 };
+        std::atomic<std::uint64_t> decoded_packets{ 0 };
+        std::atomic<std::uint64_t> decode_errors{ 0 };
+        std::atomic<std::uint64_t> decode_time_ns{ 0 };
+        std::atomic<std::uint32_t> queued_samples{ 0 };
+        std::atomic<float>         playback_latency_ms{ 0.f };
+        std::atomic<float>         capture_to_push_ms{ 0.f };
+        std::atomic<float>         push_to_playout_ms{ 0.f };
+        std::atomic<float>         capture_to_playout_ms{ 0.f };
+        std::atomic<std::uint64_t> latency_samples{ 0 };
+    };
+
+    enum class marker_state : std::uint8_t {
+        buffered,
+        queued,
+        discarded
+    };
+
+    // first sample of timestamped packet, positions are in samples written to the ring buffer and uploaded to
+    // OpenAL buffers since creation
+    struct latency_marker {
+        std::uint64_t position{ 0 };
+        std::uint64_t queue_position{ 0 };
+        std::uint64_t capture_us{ 0 };
+        std::uint64_t push_us{ 0 };
+        marker_state  state{ marker_state::buffered };
+    };
+
+    // decoded samples staged in the ring buffer write region, published with a single commit
+    struct write_batch {
+        typename ring_buffer_t::Spans spans;
+        std::size_t                   staged{ 0 };
+        std::size_t                   total{ 0 };
+        std::size_t                   written{ 0 };
+    };
+
+    struct arrival_tracker {
+        std::atomic<std::int64_t>  last_arrival_ns{ 0 };
+        std::atomic<std::uint32_t> last_packet_samples{ 0 };
+        std::atomic<float>         jitter_ms{ 0.f };
+    };
+
+    bool begin_push();
+    void end_push();
+    bool wake();
+    void hibernate();
+    [[nodiscard]] bool idle_expired() const;
+
+    bool decode_packet(const opus_packet& packet, write_batch& batch);
+    void write_samples(const SampleT* samples, std::size_t count, resampler* converter, write_batch& batch);
+    template <typename InputT>
+    void convert_pcm(const InputT* samples, std::size_t count, resampler* converter, write_batch& batch);
+    void flush_batch(write_batch& batch);
+    void refresh_gain();
     void setup_spatial() const;
     void update_source(std::uint32_t source) const;
     void drop_source();
+    void unqueue_processed(std::int32_t processed);
+    void update_latency();
+    void consume_latency_markers(std::size_t count, marker_state state);
+    void resolve_latency_markers(double offset_sec, double latency_sec);
+    void enforce_max_latency();
+    void track_arrival(std::uint32_t packet_samples);
+    [[nodiscard]] std::uint32_t target_buffered_samples() const;
+    [[nodiscard]] bool          arrivals_stalled() const;
+    void skip_to_newest(std::size_t buffered, std::size_t keep);
+    std::size_t remove_silence(std::size_t buffered, std::size_t excess);
 
     std::array<std::uint32_t, kBuffersCount> buffers{};
-    std::queue<std::uint32_t>                free_buffers{};
+    std::array<std::uint32_t, kBuffersCount> buffer_samples{};
+    // stack of unqueued buffers
+    std::array<std::uint32_t, kBuffersCount> free_buffers{};
+    std::size_t                              free_buffer_count{ 0 };
+    // upload granularity and queue depth of the latency profile
+    std::size_t                              buffer_chunk_size{ kBufferChunkSize };
+    std::size_t                              max_queued_buffers{ kBuffersCount };
     std::uint32_t                            source{ 0 };
-    std::chrono::steady_clock::time_point    last_source_request_time{};
     std::int32_t                             sample_rate{ 0 };
+    std::int32_t                             codec_rate{ 0 };
 
-    vector position{};
-    vector velocity{};
-    vector direction{};
+    // position, velocity, direction and distances live in a row of the output spatial table
+    spatial_table* spatial{ nullptr };
+    std::uint32_t  spatial_id{ spatial_table::kNoId };
+    bool           owns_spatial_id{ false };
 
     float output_gain{ 1.f };
-    float min_distance{ 0.f };
-    float max_distance{ 100.f };
-    float rollof_factor{ 1.f };
-    float extra_gain{ 1.f };
 
+    // stream gain times the group gain, set as AL_GAIN of the source
+    float                  applied_gain{ 1.f };
+    const gain_group_impl* group_impl{ nullptr };
+    std::uint32_t          group_generation{ 0 };
+
+    std::uint32_t   max_latency_samples{ 0 };
+    overflow_policy latency_policy{ overflow_policy::none };
+
+    resampler          rate_converter;
+    // ring buffer and scratch buffers, null while hibernated
+    std::unique_ptr<storage_t> storage{};
+    // pushed pcm at a rate other than the device rate, created on first such push
+    std::optional<resampler>   pcm_converter{};
+    std::uint32_t              pcm_rate{ 0 };
     OpusDecoder*       decoder{ nullptr };
     sound_output_impl* output_impl{ nullptr };
 
     sconnection_t signal_connection;
 
+    counters        stats{};
+    arrival_tracker arrivals{};
+
+    std::atomic<hibernation_state> hibernation{ hibernation_state::active };
+    // time of creation or the last wake, in ns of steady_clock
+    std::int64_t active_since_ns{ 0 };
+
+    // sample positions of the producer, and of the consumer: read from the ring, uploaded and played out buffers
+    // ring positions are written by a single thread each, readers of stats compute the buffered samples from them
+    std::atomic<std::uint64_t> write_total{ 0 };
+    std::atomic<std::uint64_t> read_total{ 0 };
+    std::uint64_t uploaded_total{ 0 };
+    std::uint64_t dequeued_total{ 0 };
+
+    jnk0le::Ringbuffer<latency_marker, kLatencyMarkersSize, false, kCacheLineSize> latency_markers{};
+
+    std::atomic<packet_log_writer*> packet_log{ nullptr };
+    std::atomic<std::uint32_t>      packet_log_id{ 0 };
+
     bool playing{ false };
     bool has_source{ false };
     bool source_used_once{ false };
+    // set once the current stop is counted as an underrun, cleared when playback restarts
+    bool underrun_counted{ false };
     bool is_spatial{ true };
-
-    jnk0le::Ringbuffer<float, kRingBufferSize, true> ring_buffer{};
+    bool has_buffers{ false };
 };
+
+extern template class stream_impl<float>;
+extern template class stream_impl<std::int16_t>;
 }
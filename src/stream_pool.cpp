@@ -0,0 +1,115 @@
+#include "stream_pool.hpp"
+
+#include <algorithm>
+#include <opus.h>
+
+#include "thread_utils.hpp"
+#include "voice_exception.hpp"
+
+template <typename SampleT>
+kvoice::storage_pool<SampleT>::storage_pool(std::size_t max_free, bool lock_memory,
+                                            std::pmr::memory_resource* resource)
+    : resource(resource),
+      free_storages(resource),
+      max_free(max_free),
+      lock_memory(lock_memory) {
+    free_storages.reserve(max_free);
+}
+
+template <typename SampleT>
+kvoice::storage_pool<SampleT>::~storage_pool() {
+    for (auto& storage : free_storages) destroy(std::move(storage));
+}
+
+template <typename SampleT>
+std::unique_ptr<kvoice::stream_storage<SampleT>> kvoice::storage_pool<SampleT>::acquire() {
+    {
+        std::unique_lock lck(pool_mutex);
+        if (!free_storages.empty()) {
+            auto storage = std::move(free_storages.back());
+            free_storages.pop_back();
+            return storage;
+        }
+    }
+
+    // default initialized, make_unique would zero the whole ring buffer first
+    std::unique_ptr<stream_storage<SampleT>> storage{ new (resource) stream_storage<SampleT> };
+    if (lock_memory)
+        storage->memory_locked = kvoice::lock_memory(storage.get(), sizeof(stream_storage<SampleT>));
+    return storage;
+}
+
+template <typename SampleT>
+void kvoice::storage_pool<SampleT>::release(std::unique_ptr<stream_storage<SampleT>> storage) noexcept {
+    {
+        std::unique_lock lck(pool_mutex);
+        if (free_storages.size() < max_free) {
+            free_storages.push_back(std::move(storage));
+            return;
+        }
+    }
+    destroy(std::move(storage));
+}
+
+template <typename SampleT>
+void kvoice::storage_pool<SampleT>::destroy(std::unique_ptr<stream_storage<SampleT>> storage) noexcept {
+    if (storage->memory_locked)
+        unlock_memory(storage.get(), sizeof(stream_storage<SampleT>));
+}
+
+kvoice::decoder_pool::decoder_pool(std::size_t max_free, std::pmr::memory_resource* resource)
+    : resource(resource),
+      free_decoders(resource),
+      max_free(max_free),
+      decoder_size(static_cast<std::size_t>(opus_decoder_get_size(1))) {
+    free_decoders.reserve(max_free);
+}
+
+kvoice::decoder_pool::~decoder_pool() {
+    for (const auto& free : free_decoders) destroy(free.decoder);
+}
+
+OpusDecoder* kvoice::decoder_pool::acquire(std::uint32_t sample_rate) {
+    {
+        std::unique_lock lck(pool_mutex);
+        const auto       it = std::find_if(free_decoders.begin(), free_decoders.end(),
+                                           [sample_rate](const entry& e) { return e.sample_rate == sample_rate; });
+        if (it != free_decoders.end()) {
+            auto* decoder = it->decoder;
+            *it = free_decoders.back();
+            free_decoders.pop_back();
+            return decoder;
+        }
+    }
+
+    // decoder state holds no pointers, so it is initialized in place instead of opus_decoder_create
+    auto*     decoder = static_cast<OpusDecoder*>(resource->allocate(decoder_size, alignof(std::max_align_t)));
+    const int opus_err = opus_decoder_init(decoder, static_cast<opus_int32>(sample_rate), 1);
+
+    if (opus_err != OPUS_OK) {
+        destroy(decoder);
+        throw voice_exception::create_formatted(
+            "Failed to opus decoder (errc = {})", opus_err);
+    }
+    return decoder;
+}
+
+void kvoice::decoder_pool::release(OpusDecoder* decoder, std::uint32_t sample_rate) noexcept {
+    // released decoder is reused by another stream, so the previous stream state has to go
+    opus_decoder_ctl(decoder, OPUS_RESET_STATE);
+    {
+        std::unique_lock lck(pool_mutex);
+        if (free_decoders.size() < max_free) {
+            free_decoders.push_back({ decoder, sample_rate });
+            return;
+        }
+    }
+    destroy(decoder);
+}
+
+void kvoice::decoder_pool::destroy(OpusDecoder* decoder) noexcept {
+    resource->deallocate(decoder, decoder_size, alignof(std::max_align_t));
+}
+
+template class kvoice::storage_pool<float>;
+template class kvoice::storage_pool<std::int16_t>;
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+#include "resource_allocated.hpp"
+#include "ringbuffer.hpp"
+
+struct OpusDecoder;
+
+namespace kvoice {
+/**
+ * @brief heavy buffers of a stream, returned to the output pool while the stream hibernates
+ * @tparam SampleT float or std::int16_t
+ */
+template <typename SampleT>
+struct stream_storage : resource_allocated {
+    static constexpr auto kRingBufferSize = 262144;
+    // max opus packet duration, 120 ms at 48 kHz
+    static constexpr auto kOpusBufferSize = 5760;
+
+    // producer and consumer run on different threads, indices are on separate cache lines
+    using ring_buffer_t = jnk0le::Ringbuffer<SampleT, kRingBufferSize, false, kCacheLineSize>;
+
+    ring_buffer_t ring{};
+    // scratch buffers of the producer thread, for packets that can't be decoded straight into the ring buffer
+    std::array<SampleT, kOpusBufferSize> decode_buffer;
+    std::array<SampleT, kOpusBufferSize> resample_buffer;
+    bool                                 memory_locked{ false };
+};
+
+/**
+ * @brief free list of stream storages shared by streams of one output, safe to use from any thread
+ * @tparam SampleT float or std::int16_t, instantiated in stream_pool.cpp
+ */
+template <typename SampleT>
+class storage_pool {
+public:
+    /**
+     * @brief Constructor
+     * @param max_free count of released storages kept for reuse, the rest is freed
+     * @param lock_memory lock storages in memory
+     * @param resource resource of the storages and of the free list
+     */
+    storage_pool(std::size_t max_free, bool lock_memory, std::pmr::memory_resource* resource);
+    ~storage_pool();
+
+    /**
+     * @brief takes released storage, or allocates a new one if there is none
+     * @details ring buffer of the returned storage is empty
+     */
+    std::unique_ptr<stream_storage<SampleT>> acquire();
+    /**
+     * @brief returns storage with empty ring buffer to the pool
+     */
+    void release(std::unique_ptr<stream_storage<SampleT>> storage) noexcept;
+
+private:
+    void destroy(std::unique_ptr<stream_storage<SampleT>> storage) noexcept;
+
+    std::mutex                                                 pool_mutex;
+    std::pmr::memory_resource*                                 resource{ nullptr };
+    std::pmr::vector<std::unique_ptr<stream_storage<SampleT>>> free_storages;
+    std::size_t                                                max_free{ 0 };
+    bool                                                       lock_memory{ false };
+};
+
+/**
+ * @brief free list of opus decoders shared by streams of one output, safe to use from any thread
+ * @details decoders are initialized in place in memory of the pool resource
+ */
+class decoder_pool {
+public:
+    /**
+     * @brief Constructor
+     * @param max_free count of released decoders kept for reuse, the rest is destroyed
+     * @param resource resource of the decoders and of the free list
+     */
+    decoder_pool(std::size_t max_free, std::pmr::memory_resource* resource);
+    ~decoder_pool();
+
+    /**
+     * @brief takes released decoder of @p sample_rate, or creates a new one if there is none
+     * @throws voice_exception if decoder couldn't be created
+     */
+    OpusDecoder* acquire(std::uint32_t sample_rate);
+    /**
+     * @brief resets decoder state and returns it to the pool
+     */
+    void release(OpusDecoder* decoder, std::uint32_t sample_rate) noexcept;
+
+private:
+    struct entry {
+        OpusDecoder*  decoder{ nullptr };
+        std::uint32_t sample_rate{ 0 };
+    };
+
+    void destroy(OpusDecoder* decoder) noexcept;
+
+    std::mutex                 pool_mutex;
+    std::pmr::memory_resource* resource{ nullptr };
+    std::pmr::vector<entry>    free_decoders;
+    std::size_t                max_free{ 0 };
+    // size of mono decoder state
+    std::size_t                decoder_size{ 0 };
+};
+
+extern template class storage_pool<float>;
+extern template class storage_pool<std::int16_t>;
+}
@@ -0,0 +1,176 @@
+#include "thread_utils.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <Windows.h>
+#else
+#   include <pthread.h>
+#   include <sched.h>
+#   include <sys/mman.h>
+#   include <sys/resource.h>
+#   include <unistd.h>
+#   ifdef __linux__
+#       include <sys/syscall.h>
+#   endif
+#endif
+
+namespace {
+void append_error(std::string& errors, std::string_view error) {
+    if (!errors.empty()) errors += "; ";
+    errors += error;
+}
+
+std::size_t page_size() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+#ifdef _WIN32
+void set_thread_name(const std::string& name, std::string& errors) {
+    // SetThreadDescription is available since Windows 10 1607 only
+    using set_description_t = HRESULT(WINAPI*)(HANDLE, PCWSTR);
+    const auto set_description = reinterpret_cast<set_description_t>(
+        reinterpret_cast<void*>(GetProcAddress(GetModuleHandleA("kernel32.dll"), "SetThreadDescription")));
+    if (!set_description) {
+        append_error(errors, "thread names aren't supported");
+        return;
+    }
+
+    std::wstring wide_name(name.size(), L'\0');
+    wide_name.resize(static_cast<std::size_t>(MultiByteToWideChar(
+        CP_UTF8, 0, name.data(), static_cast<int>(name.size()), wide_name.data(), static_cast<int>(wide_name.size()))));
+    if (FAILED(set_description(GetCurrentThread(), wide_name.c_str())))
+        append_error(errors, "couldn't set thread name");
+}
+#else
+void set_thread_name(const std::string& name, std::string& errors) {
+    constexpr auto kMaxThreadNameLength = 15;
+
+    const auto truncated = name.substr(0, kMaxThreadNameLength);
+#   ifdef __APPLE__
+    const int rc = pthread_setname_np(truncated.c_str());
+#   else
+    const int rc = pthread_setname_np(pthread_self(), truncated.c_str());
+#   endif
+    if (rc != 0) append_error(errors, std::string{ "couldn't set thread name: " } + std::strerror(rc));
+}
+#endif
+}
+
+kvoice::thread_report kvoice::apply_thread_config(const thread_config& config, std::string_view default_name) {
+    thread_report report;
+    report.started = true;
+    report.name = std::string{ config.name.empty() ? default_name : config.name };
+
+    set_thread_name(report.name, report.errors);
+
+#ifdef _WIN32
+    if (config.scheduling != thread_scheduling::normal &&
+        !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+        append_error(report.errors, "couldn't set time critical priority");
+    }
+    report.priority = GetThreadPriority(GetCurrentThread());
+    report.scheduling = report.priority == THREAD_PRIORITY_TIME_CRITICAL ? config.scheduling : thread_scheduling::normal;
+
+    DWORD_PTR process_mask, system_mask;
+    GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask);
+    report.affinity_mask = process_mask;
+    if (config.affinity_mask) {
+        if (SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(config.affinity_mask)))
+            report.affinity_mask = config.affinity_mask;
+        else
+            append_error(report.errors, "couldn't set affinity");
+    }
+#else
+    if (config.scheduling != thread_scheduling::normal) {
+        const int policy = config.scheduling == thread_scheduling::fifo ? SCHED_FIFO : SCHED_RR;
+
+        sched_param param{};
+        param.sched_priority = std::clamp(config.priority, sched_get_priority_min(policy),
+                                          sched_get_priority_max(policy));
+        if (const int rc = pthread_setschedparam(pthread_self(), policy, &param); rc != 0) {
+            append_error(report.errors, std::string{ "real-time scheduling denied: " } + std::strerror(rc));
+#   ifdef __linux__
+            // without CAP_SYS_NICE or rtkit grant, take the highest priority RLIMIT_NICE allows to this thread
+            const auto tid = static_cast<id_t>(syscall(SYS_gettid));
+            for (int nice = -20; nice < 0; ++nice) {
+                if (setpriority(PRIO_PROCESS, tid, nice) == 0) break;
+            }
+#   endif
+        }
+    }
+
+    int         policy;
+    sched_param param{};
+    if (pthread_getschedparam(pthread_self(), &policy, &param) == 0) {
+        if (policy == SCHED_FIFO) report.scheduling = thread_scheduling::fifo;
+        else if (policy == SCHED_RR) report.scheduling = thread_scheduling::round_robin;
+        report.priority = param.sched_priority;
+    }
+#   ifdef __linux__
+    if (report.scheduling == thread_scheduling::normal)
+        report.priority = getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)));
+
+    cpu_set_t cpus;
+    if (config.affinity_mask) {
+        CPU_ZERO(&cpus);
+        for (auto cpu = 0u; cpu < 64 && cpu < CPU_SETSIZE; ++cpu) {
+            if (config.affinity_mask & (std::uint64_t{ 1 } << cpu)) CPU_SET(cpu, &cpus);
+        }
+        if (const int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus); rc != 0)
+            append_error(report.errors, std::string{ "couldn't set affinity: " } + std::strerror(rc));
+    }
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0) {
+        for (auto cpu = 0u; cpu < 64 && cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &cpus)) report.affinity_mask |= std::uint64_t{ 1 } << cpu;
+        }
+    }
+#   else
+    if (config.affinity_mask) append_error(report.errors, "thread affinity isn't supported");
+#   endif
+#endif
+    return report;
+}
+
+bool kvoice::lock_memory(void* data, std::size_t size) noexcept {
+    if (!data || !size) return true;
+
+    // touch every page, so locked range doesn't fault on the first write from audio thread
+    auto*             bytes = static_cast<volatile unsigned char*>(data);
+    const std::size_t step = page_size();
+    for (std::size_t offset = 0; offset < size; offset += step) bytes[offset] = bytes[offset];
+    bytes[size - 1] = bytes[size - 1];
+
+#ifdef _WIN32
+    if (VirtualLock(data, size)) return true;
+    if (GetLastError() != ERROR_WORKING_SET_QUOTA) return false;
+
+    // grow the working set by the locked range and retry
+    SIZE_T min_size, max_size;
+    if (!GetProcessWorkingSetSize(GetCurrentProcess(), &min_size, &max_size) ||
+        !SetProcessWorkingSetSize(GetCurrentProcess(), min_size + size, max_size + size))
+        return false;
+    return VirtualLock(data, size) != 0;
+#else
+    return mlock(data, size) == 0;
+#endif
+}
+
+void kvoice::unlock_memory(void* data, std::size_t size) noexcept {
+    if (!data || !size) return;
+#ifdef _WIN32
+    VirtualUnlock(data, size);
+#else
+    munlock(data, size);
+#endif
+}
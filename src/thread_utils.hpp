@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+#include "thread_config.hpp"
+
+namespace kvoice {
+/**
+ * @brief applies name, scheduling and affinity to the calling thread
+ * @param config thread parameters, @p lock_memory is left to the caller
+ * @param default_name name used if @p config has none
+ * @return parameters the thread actually got
+ */
+thread_report apply_thread_config(const thread_config& config, std::string_view default_name);
+
+/**
+ * @brief pre-faults memory range and locks it in physical memory
+ * @param data start of the range
+ * @param size size of the range in bytes
+ * @return true if the range is locked
+ */
+bool lock_memory(void* data, std::size_t size) noexcept;
+
+/**
+ * @brief unlocks memory range locked by @p lock_memory
+ * @param data start of the range
+ * @param size size of the range in bytes
+ */
+void unlock_memory(void* data, std::size_t size) noexcept;
+}
@@ -0,0 +1,226 @@
+#include "tracing.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "fmt/core.h"
+
+namespace {
+constexpr std::array<std::string_view, static_cast<std::size_t>(kvoice::trace_point::count)> kTracePointNames{
+    "capture_samples", "opus_encode", "input_callback", "raw_input_callback",
+    "opus_decode", "ring_write", "ring_read", "buffer_data"
+};
+
+#ifdef KVOICE_TRACING
+// log-linear histogram: 16 linear sub-buckets per power of two, exact below 32ns
+constexpr auto kSubBucketBits = 4;
+constexpr auto kSubBucketCount = 1u << kSubBucketBits;
+constexpr auto kMaxMagnitude = 40;
+constexpr auto kBucketCount = (kMaxMagnitude - kSubBucketBits + 2) * kSubBucketCount;
+constexpr auto kPointsCount = static_cast<std::size_t>(kvoice::trace_point::count);
+constexpr auto kEventsCount = 8192u;
+
+struct trace_event {
+    std::atomic<std::uint64_t> start_ns{ 0 };
+    // duration in ns shifted by 8 bits, trace point in the low 8 bits
+    std::atomic<std::uint64_t> packed{ 0 };
+};
+
+struct thread_trace {
+    std::uint32_t id{ 0 };
+
+    std::array<std::array<std::atomic<std::uint64_t>, kBucketCount>, kPointsCount> buckets{};
+    std::array<std::atomic<std::uint64_t>, kPointsCount>                           max_ns{};
+
+    std::array<trace_event, kEventsCount> events{};
+    std::atomic<std::uint64_t>            events_pos{ 0 };
+};
+
+std::size_t bucket_index(std::uint64_t value) {
+    if (value < 2 * kSubBucketCount) return static_cast<std::size_t>(value);
+
+    auto magnitude = 63;
+    while (!(value >> magnitude)) --magnitude;
+    if (magnitude > kMaxMagnitude) return kBucketCount - 1;
+
+    const auto sub_bucket = (value >> (magnitude - kSubBucketBits)) - kSubBucketCount;
+    return static_cast<std::size_t>((magnitude - kSubBucketBits + 1) * kSubBucketCount + sub_bucket);
+}
+
+std::uint64_t bucket_value(std::size_t index) {
+    if (index < 2 * kSubBucketCount) return index;
+
+    const auto magnitude = index / kSubBucketCount + kSubBucketBits - 1;
+    const auto shift = magnitude - kSubBucketBits;
+    const auto lower = (index % kSubBucketCount + kSubBucketCount) << shift;
+    // middle of the bucket halves the worst case error
+    return lower + ((std::uint64_t{ 1 } << shift) >> 1);
+}
+
+std::chrono::steady_clock::time_point trace_epoch() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return epoch;
+}
+
+std::mutex& registry_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+// thread blocks are never freed, so summaries of finished threads stay readable
+std::vector<std::unique_ptr<thread_trace>>& registry() {
+    static std::vector<std::unique_ptr<thread_trace>> threads;
+    return threads;
+}
+
+thread_trace& local_trace() {
+    thread_local thread_trace* local = []() {
+        std::unique_lock lck(registry_mutex());
+        auto&            threads = registry();
+
+        threads.emplace_back(std::make_unique<thread_trace>());
+        threads.back()->id = static_cast<std::uint32_t>(threads.size() - 1);
+        return threads.back().get();
+    }();
+    return *local;
+}
+
+void increment(std::atomic<std::uint64_t>& value) {
+    // every block has a single writer, so plain load/store is enough
+    value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+#endif
+}
+
+#ifdef KVOICE_TRACING
+void kvoice::trace_record(trace_point point, std::chrono::steady_clock::time_point start,
+                          std::chrono::steady_clock::time_point end) noexcept {
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+
+    auto&      local = local_trace();
+    const auto idx = static_cast<std::size_t>(point);
+    const auto duration = static_cast<std::uint64_t>(duration_cast<nanoseconds>(end - start).count());
+    const auto start_ns = static_cast<std::uint64_t>(duration_cast<nanoseconds>(start - trace_epoch()).count());
+
+    increment(local.buckets[idx][bucket_index(duration)]);
+    if (duration > local.max_ns[idx].load(std::memory_order_relaxed))
+        local.max_ns[idx].store(duration, std::memory_order_relaxed);
+
+    const auto pos = local.events_pos.load(std::memory_order_relaxed);
+    auto&      event = local.events[pos % kEventsCount];
+    event.start_ns.store(start_ns, std::memory_order_relaxed);
+    event.packed.store((duration << 8) | idx, std::memory_order_relaxed);
+    local.events_pos.store(pos + 1, std::memory_order_release);
+}
+#endif
+
+bool kvoice::trace_enabled() {
+#ifdef KVOICE_TRACING
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::vector<kvoice::trace_summary> kvoice::trace_dump() {
+    std::vector<trace_summary> result;
+#ifdef KVOICE_TRACING
+    std::unique_lock lck(registry_mutex());
+
+    std::array<std::uint64_t, kBucketCount> counts{};
+    for (const auto& thread : registry()) {
+        for (auto point = 0u; point < kPointsCount; ++point) {
+            std::uint64_t total = 0;
+            for (auto i = 0u; i < kBucketCount; ++i) {
+                counts[i] = thread->buckets[point][i].load(std::memory_order_relaxed);
+                total += counts[i];
+            }
+            if (total == 0) continue;
+
+            trace_summary summary;
+            summary.point = static_cast<trace_point>(point);
+            summary.name = kTracePointNames[point];
+            summary.thread_id = thread->id;
+            summary.count = total;
+            summary.max_ns = thread->max_ns[point].load(std::memory_order_relaxed);
+
+            const std::pair<double, std::uint64_t*> percentiles[]{
+                { 0.5, &summary.p50_ns }, { 0.9, &summary.p90_ns },
+                { 0.99, &summary.p99_ns }, { 0.999, &summary.p999_ns }
+            };
+
+            std::uint64_t cumulative = 0;
+            auto          percentile = std::begin(percentiles);
+            for (auto i = 0u; i < kBucketCount && percentile != std::end(percentiles); ++i) {
+                cumulative += counts[i];
+                while (percentile != std::end(percentiles) &&
+                       static_cast<double>(cumulative) >= percentile->first * static_cast<double>(total)) {
+                    *percentile->second = std::min(bucket_value(i), summary.max_ns);
+                    ++percentile;
+                }
+            }
+            result.push_back(summary);
+        }
+    }
+#endif
+    return result;
+}
+
+void kvoice::trace_reset() {
+#ifdef KVOICE_TRACING
+    std::unique_lock lck(registry_mutex());
+
+    for (auto& thread : registry()) {
+        for (auto& point_buckets : thread->buckets) {
+            for (auto& bucket : point_buckets) bucket.store(0, std::memory_order_relaxed);
+        }
+        for (auto& max : thread->max_ns) max.store(0, std::memory_order_relaxed);
+        thread->events_pos.store(0, std::memory_order_relaxed);
+    }
+#endif
+}
+
+bool kvoice::trace_export_chrome(std::string_view path) {
+#ifdef KVOICE_TRACING
+    std::unique_lock lck(registry_mutex());
+
+    std::FILE* file = std::fopen(std::string{ path }.c_str(), "w");
+    if (!file) return false;
+
+    fmt::print(file, "{{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    bool first = true;
+    for (const auto& thread : registry()) {
+        fmt::print(file, "{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},"
+                   "\"args\":{{\"name\":\"kvoice thread {}\"}}}}", first ? "" : ",", thread->id, thread->id);
+        first = false;
+
+        const auto end = thread->events_pos.load(std::memory_order_acquire);
+        const auto begin = end > kEventsCount ? end - kEventsCount : 0;
+        for (auto i = begin; i < end; ++i) {
+            const auto& event = thread->events[i % kEventsCount];
+            const auto  packed = event.packed.load(std::memory_order_relaxed);
+            const auto  point = static_cast<std::size_t>(packed & 0xFF);
+            if (point >= kPointsCount) continue;
+
+            fmt::print(file, ",{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                       kTracePointNames[point], thread->id,
+                       static_cast<double>(event.start_ns.load(std::memory_order_relaxed)) / 1000.0,
+                       static_cast<double>(packed >> 8) / 1000.0);
+        }
+    }
+
+    fmt::print(file, "]}}\n");
+    return std::fclose(file) == 0;
+#else
+    (void)path;
+    return false;
+#endif
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+
+#include "trace.hpp"
+
+namespace kvoice {
+#ifdef KVOICE_TRACING
+/**
+ * @brief records one timed span into the calling thread histogram and event ring
+ * @param point instrumented location
+ * @param start span start time
+ * @param end span end time
+ */
+void trace_record(trace_point point, std::chrono::steady_clock::time_point start,
+                  std::chrono::steady_clock::time_point end) noexcept;
+
+/**
+ * @brief RAII timer that records the span of its own lifetime
+ */
+class trace_scope {
+public:
+    explicit trace_scope(trace_point point) noexcept
+        : point(point),
+          start(std::chrono::steady_clock::now()) {
+    }
+
+    ~trace_scope() { trace_record(point, start, std::chrono::steady_clock::now()); }
+
+    trace_scope(const trace_scope&) = delete;
+    trace_scope& operator=(const trace_scope&) = delete;
+
+private:
+    trace_point                           point;
+    std::chrono::steady_clock::time_point start;
+};
+
+#   define KVOICE_TRACE_CONCAT_IMPL(a, b) a##b
+#   define KVOICE_TRACE_CONCAT(a, b) KVOICE_TRACE_CONCAT_IMPL(a, b)
+#   define KVOICE_TRACE_SCOPE(point) \
+        const ::kvoice::trace_scope KVOICE_TRACE_CONCAT(kvoice_trace_scope_, __LINE__) { ::kvoice::trace_point::point }
+#else
+#   define KVOICE_TRACE_SCOPE(point) static_cast<void>(0)
+#endif
+}
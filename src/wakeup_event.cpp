@@ -0,0 +1,73 @@
+#include "wakeup_event.hpp"
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <Windows.h>
+#elif defined(__linux__)
+#   include <sys/eventfd.h>
+#   include <unistd.h>
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#include <cstdint>
+
+#include "voice_exception.hpp"
+
+kvoice::wakeup_event::wakeup_event() {
+#ifdef _WIN32
+    read_handle = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    if (!read_handle) throw voice_exception("Couldn't create wakeup event");
+#elif defined(__linux__)
+    read_handle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (read_handle < 0) throw voice_exception("Couldn't create wakeup event");
+#else
+    int fds[2];
+    if (pipe(fds) != 0) throw voice_exception("Couldn't create wakeup event");
+    for (const int fd : fds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    read_handle = fds[0];
+    write_handle = fds[1];
+#endif
+}
+
+kvoice::wakeup_event::~wakeup_event() {
+#ifdef _WIN32
+    CloseHandle(read_handle);
+#elif defined(__linux__)
+    close(read_handle);
+#else
+    close(read_handle);
+    close(write_handle);
+#endif
+}
+
+void kvoice::wakeup_event::signal() noexcept {
+#ifdef _WIN32
+    SetEvent(read_handle);
+#elif defined(__linux__)
+    const std::uint64_t one = 1;
+    [[maybe_unused]] const auto written = write(read_handle, &one, sizeof(one));
+#else
+    // a full pipe is already readable, so a failed write is fine
+    const char one = 1;
+    [[maybe_unused]] const auto written = write(write_handle, &one, sizeof(one));
+#endif
+}
+
+void kvoice::wakeup_event::reset() noexcept {
+#ifdef _WIN32
+    ResetEvent(read_handle);
+#elif defined(__linux__)
+    std::uint64_t value;
+    [[maybe_unused]] const auto read_bytes = read(read_handle, &value, sizeof(value));
+#else
+    char buffer[64];
+    while (read(read_handle, buffer, sizeof(buffer)) > 0) {
+    }
+#endif
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "sound_input.hpp"
+
+namespace kvoice {
+/**
+ * @brief level-triggered event that can be waited on with native poll/select/WaitForSingleObject
+ * @details eventfd on Linux, nonblocking pipe on other POSIX systems, manual-reset event on Windows
+ */
+class wakeup_event {
+public:
+    /**
+     * @brief Constructor
+     * @throws voice_exception if native event couldn't be created
+     */
+    wakeup_event();
+    ~wakeup_event();
+
+    wakeup_event(const wakeup_event&) = delete;
+    wakeup_event& operator=(const wakeup_event&) = delete;
+
+    /**
+     * @brief makes the handle readable, safe to call from any thread
+     */
+    void signal() noexcept;
+
+    /**
+     * @brief makes the handle non-readable, safe to call from any thread
+     */
+    void reset() noexcept;
+
+    [[nodiscard]] wakeup_handle_t native_handle() const { return read_handle; }
+
+private:
+    wakeup_handle_t read_handle{};
+#if !defined(_WIN32) && !defined(__linux__)
+    wakeup_handle_t write_handle{};
+#endif
+};
+}
@@ -0,0 +1,315 @@
+#include "kvoice/kvoice.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Allocation check of steady-state hot paths: PCM sources are encoded by an encoder farm, packets are pushed
+// into streams of a sound output that is updated like a game tick, optionally a capture device is encoded too.
+// After a warm-up every allocation is counted per stage, the check fails if kvoice stages allocate.
+//
+//   kvoice-alloc-check --streams 16 --seconds 10
+//   kvoice-alloc-check --capture                  (default capture and output devices instead of null backend)
+//
+// kvoice allocations are counted by a memory resource passed in the device configs, the rest by replacing global
+// operator new, so kvoice should be linked statically on Windows. update() calls into OpenAL, which may allocate
+// on its own, so its heap count is reported but only its kvoice count is enforced. Registered with CTest.
+
+namespace {
+using clock_type = std::chrono::steady_clock;
+
+constexpr auto kBlockMs = 10;
+
+/**
+ * @brief allocations made by the calling thread
+ */
+struct allocation_count {
+    // through the resource of the devices
+    std::uint64_t resource{ 0 };
+    // through global operator new
+    std::uint64_t heap{ 0 };
+
+    allocation_count operator-(const allocation_count& other) const {
+        return { resource - other.resource, heap - other.heap };
+    }
+};
+
+std::atomic<bool>             counting{ false };
+thread_local allocation_count thread_allocations{};
+
+void* allocate_aligned(std::size_t size, std::align_val_t align) {
+    const auto alignment = static_cast<std::size_t>(align);
+#ifdef _WIN32
+    if (void* p = _aligned_malloc(size ? size : 1, alignment)) return p;
+#else
+    if (void* p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)) return p;
+#endif
+    throw std::bad_alloc{};
+}
+
+void free_aligned(void* p) noexcept {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void* allocate(std::size_t size) {
+    if (counting.load(std::memory_order_relaxed)) ++thread_allocations.heap;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc{};
+}
+
+void* allocate_heap_aligned(std::size_t size, std::align_val_t align) {
+    if (counting.load(std::memory_order_relaxed)) ++thread_allocations.heap;
+    return allocate_aligned(size, align);
+}
+
+/**
+ * @brief thread safe resource that counts allocations of the calling thread, doesn't go through operator new
+ */
+class counting_resource final : public std::pmr::memory_resource {
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (counting.load(std::memory_order_relaxed)) ++thread_allocations.resource;
+        return allocate_aligned(bytes, std::align_val_t{ std::max(alignment, alignof(std::max_align_t)) });
+    }
+
+    void do_deallocate(void* p, std::size_t, std::size_t) override { free_aligned(p); }
+
+    [[nodiscard]] bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+/**
+ * @brief allocations made by one stage, summed over threads
+ */
+struct stage_counter {
+    std::atomic<std::uint64_t> resource_allocations{ 0 };
+    std::atomic<std::uint64_t> heap_allocations{ 0 };
+    std::atomic<std::uint64_t> calls{ 0 };
+
+    /**
+     * @brief counts allocations made by the calling thread while running @p func
+     */
+    template <typename Func>
+    void measure(Func&& func) {
+        const auto before = thread_allocations;
+        func();
+        add(thread_allocations - before);
+    }
+
+    void add(const allocation_count& count) {
+        resource_allocations.fetch_add(count.resource, std::memory_order_relaxed);
+        heap_allocations.fetch_add(count.heap, std::memory_order_relaxed);
+        calls.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void reset() {
+        resource_allocations.store(0);
+        heap_allocations.store(0);
+        calls.store(0);
+    }
+};
+
+struct options {
+    std::uint32_t streams{ 16 };
+    std::uint32_t seconds{ 10 };
+    std::uint32_t warmup_seconds{ 2 };
+    std::uint32_t tick_ms{ 10 };
+    std::uint32_t packet_ms{ 20 };
+    bool          capture{ false };
+};
+
+bool parse_options(int argc, char** argv, options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--capture") {
+            opts.capture = true;
+            continue;
+        }
+
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value) return false;
+
+        if (arg == "--streams") opts.streams = std::strtoul(value, nullptr, 10);
+        else if (arg == "--seconds") opts.seconds = std::strtoul(value, nullptr, 10);
+        else if (arg == "--warmup") opts.warmup_seconds = std::strtoul(value, nullptr, 10);
+        else if (arg == "--tick") opts.tick_ms = std::strtoul(value, nullptr, 10);
+        else if (arg == "--packet") opts.packet_ms = std::strtoul(value, nullptr, 10);
+        else return false;
+        ++i;
+    }
+    return opts.streams > 0 && opts.tick_ms > 0;
+}
+
+/**
+ * @param heap_enforced false if heap allocations of the stage may come from OpenAL
+ */
+bool print_stage(const char* name, const stage_counter& stage, bool heap_enforced) {
+    const auto resource = stage.resource_allocations.load();
+    const auto heap = stage.heap_allocations.load();
+    const auto calls = stage.calls.load();
+    const bool ok = resource == 0 && (!heap_enforced || heap == 0);
+    std::printf("%-16s calls %10llu  kvoice %8llu  heap %8llu%s  %s\n", name, static_cast<unsigned long long>(calls),
+                static_cast<unsigned long long>(resource), static_cast<unsigned long long>(heap),
+                heap_enforced ? "" : " (info)", ok ? "ok" : "FAIL");
+    return ok;
+}
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void* operator new(std::size_t size, std::align_val_t align) { return allocate_heap_aligned(size, align); }
+void* operator new[](std::size_t size, std::align_val_t align) { return allocate_heap_aligned(size, align); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { free_aligned(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { free_aligned(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { free_aligned(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { free_aligned(p); }
+
+int main(int argc, char** argv) {
+    options opts;
+    if (!parse_options(argc, argv, opts)) {
+        std::fprintf(stderr, "usage: %s [--streams N] [--seconds S] [--warmup S] [--tick MS] [--packet MS]\n"
+                     "          [--capture]\n", argv[0]);
+        return 1;
+    }
+
+    if (!opts.capture) {
+#ifdef _WIN32
+        _putenv_s("ALSOFT_DRIVERS", "null");
+#else
+        setenv("ALSOFT_DRIVERS", "null", 0);
+#endif
+    }
+
+    counting_resource resource;
+
+    kvoice::sound_output_config output_config;
+    output_config.src_count = opts.streams + 1;
+    output_config.memory_resource = &resource;
+
+    auto [output, output_error] = kvoice::create_sound_output(output_config);
+    if (!output) {
+        std::fprintf(stderr, "couldn't create sound output: %s\n", output_error.c_str());
+        return 1;
+    }
+
+    kvoice::encoder_farm_config farm_config;
+    farm_config.memory_resource = &resource;
+
+    auto [farm, farm_error] = kvoice::create_encoder_farm(farm_config);
+    if (!farm) {
+        std::fprintf(stderr, "couldn't create encoder farm: %s\n", farm_error.c_str());
+        return 1;
+    }
+
+    stage_counter encode;
+    stage_counter push_decode;
+    stage_counter push_pcm;
+    stage_counter update;
+    stage_counter capture;
+
+    // the worker thread between two packet callbacks of any source does only encoding work
+    thread_local allocation_count worker_mark{};
+
+    std::vector<std::unique_ptr<kvoice::stream>>         streams;
+    std::vector<std::unique_ptr<kvoice::encoder_source>> sources;
+    kvoice::encoder_source_config                        source_config;
+    source_config.packet_duration_ms = opts.packet_ms;
+    for (std::uint32_t i = 0; i < opts.streams; ++i) {
+        streams.push_back(output->create_stream());
+        auto* s = streams.back().get();
+        sources.push_back(farm->create_source(source_config, [&, s](const void* data, std::size_t size) {
+            encode.add(thread_allocations - worker_mark);
+            push_decode.measure([&] { s->push_opus_buffer(data, size); });
+            worker_mark = thread_allocations;
+        }));
+    }
+
+    std::unique_ptr<kvoice::sound_input> input;
+    std::unique_ptr<kvoice::stream>      capture_stream;
+    if (opts.capture) {
+        kvoice::sound_input_config input_config;
+        input_config.memory_resource = &resource;
+
+        auto [device, input_error] = kvoice::create_sound_input(input_config);
+        if (!device) {
+            std::fprintf(stderr, "couldn't create sound input: %s\n", input_error.c_str());
+            return 1;
+        }
+        input = std::move(device);
+        capture_stream = output->create_stream();
+
+        // the capture thread between two callbacks captures, resamples and encodes
+        thread_local allocation_count capture_mark{};
+        input->set_input_callback([&](const void* data, std::size_t size) {
+            capture.add(thread_allocations - capture_mark);
+            push_decode.measure([&] { capture_stream->push_opus_buffer(data, size); });
+            capture_mark = thread_allocations;
+        });
+        input->enable_input();
+    }
+
+    const auto         block_size = static_cast<std::size_t>(source_config.sample_rate / 1000 * kBlockMs);
+    std::vector<float> block(block_size);
+    double             phase = 0.0;
+
+    const auto start = clock_type::now();
+    const auto measure_start = start + std::chrono::seconds(opts.warmup_seconds);
+    const auto stop_time = measure_start + std::chrono::seconds(opts.seconds);
+    auto       next_block = start;
+    auto       tick = start;
+    bool       measuring = false;
+
+    while (tick < stop_time) {
+        std::this_thread::sleep_until(tick);
+
+        if (!measuring && clock_type::now() >= measure_start) {
+            // thread counters don't move while counting is off, so marks taken during the warm-up stay valid
+            counting.store(true);
+            for (auto* stage : { &encode, &push_decode, &push_pcm, &update, &capture }) stage->reset();
+            measuring = true;
+        }
+
+        for (; next_block <= tick; next_block += std::chrono::milliseconds(kBlockMs)) {
+            for (auto& sample : block) {
+                phase += 2.0 * 3.14159265358979323846 * 220.0 / source_config.sample_rate;
+                sample = static_cast<float>(0.3 * std::sin(phase));
+            }
+            for (auto& source : sources) push_pcm.measure([&] { source->push_pcm(block.data(), block.size()); });
+        }
+
+        for (auto& s : streams) update.measure([&] { s->update(); });
+        if (capture_stream) update.measure([&] { capture_stream->update(); });
+
+        tick += std::chrono::milliseconds(opts.tick_ms);
+    }
+    counting.store(false);
+
+    if (input) input->disable_input();
+    for (auto& source : sources) source->flush();
+
+    std::printf("%u streams, %u ms packets, %u s after %u s warm-up%s\n", opts.streams, opts.packet_ms,
+                opts.seconds, opts.warmup_seconds, opts.capture ? ", with capture" : "");
+    bool ok = print_stage("push_pcm", push_pcm, true);
+    ok = print_stage("encode", encode, true) && ok;
+    ok = print_stage("push+decode", push_decode, true) && ok;
+    if (opts.capture) ok = print_stage("capture+encode", capture, true) && ok;
+    ok = print_stage("update", update, false) && ok;
+    return ok ? 0 : 1;
+}
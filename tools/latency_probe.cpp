@@ -0,0 +1,294 @@
+#include "kvoice/kvoice.hpp"
+
+#include <opus.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// End-to-end latency probe: capture -> encode -> (simulated network delay) -> stream -> render, reports the
+// latency of every stage from packet capture timestamps and stream playout estimates.
+//
+//   kvoice-latency-probe --seconds 20 --delay 40
+//   kvoice-latency-probe --synthetic            (no capture device, OpenAL Soft null backend renders)
+//   kvoice-latency-probe --low-latency          (low latency profile, checks the 30 ms end-to-end target)
+//
+// Synthetic mode generates encoder frames in real time and timestamps them like the capture thread does.
+// OpenAL loopback devices aren't reachable through kvoice device names, so the null backend mixer clock is the
+// render clock there.
+
+namespace {
+using clock_type = std::chrono::steady_clock;
+
+constexpr auto kMaxPacketSize = 1500;
+// end-to-end target of the low latency profile on a local loopback
+constexpr auto kLowLatencyTargetMs = 30.0;
+
+struct options {
+    std::uint32_t seconds{ 10 };
+    std::uint32_t tick_ms{ 0 };
+    std::uint32_t delay_ms{ 0 };
+    std::uint32_t sample_rate{ 48000 };
+    std::uint32_t bitrate{ 32000 };
+    bool          synthetic{ false };
+    bool          low_latency{ false };
+    std::string   input_device{};
+    std::string   output_device{};
+};
+
+struct timed_packet {
+    std::vector<std::uint8_t> data;
+    std::uint64_t             capture_us{ 0 };
+    std::uint64_t             encoded_us{ 0 };
+};
+
+/**
+ * @brief packets handed from the capture thread to the playback thread
+ */
+class packet_channel {
+public:
+    void push(const void* data, std::size_t size, std::uint64_t capture_us) {
+        const auto* bytes = static_cast<const std::uint8_t*>(data);
+        std::unique_lock lck(mutex);
+        packets.push_back({ { bytes, bytes + size }, capture_us, now_us() });
+    }
+
+    /**
+     * @brief pops packets encoded at least @p delay_us ago
+     */
+    std::vector<timed_packet> pop_ready(std::uint64_t delay_us) {
+        std::vector<timed_packet> result;
+        const auto                now = now_us();
+
+        std::unique_lock lck(mutex);
+        while (!packets.empty() && packets.front().encoded_us + delay_us <= now) {
+            result.push_back(std::move(packets.front()));
+            packets.pop_front();
+        }
+        return result;
+    }
+
+    static std::uint64_t now_us() {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now().time_since_epoch()).count());
+    }
+
+private:
+    std::mutex               mutex;
+    std::deque<timed_packet> packets;
+};
+
+/**
+ * @brief collects stage latencies in ms
+ */
+class stage_samples {
+public:
+    void record(double ms) { values.push_back(ms); }
+
+    void print(const char* name) {
+        if (values.empty()) {
+            std::printf("%-18s no samples\n", name);
+            return;
+        }
+        std::sort(values.begin(), values.end());
+        std::printf("%-18s samples %7zu  p50 %7.2f ms  p99 %7.2f ms  max %7.2f ms\n", name, values.size(),
+                    percentile(0.5), percentile(0.99), values.back());
+    }
+
+    [[nodiscard]] bool empty() const { return values.empty(); }
+
+    /**
+     * @brief value at @p p of sorted samples, call after @p print
+     */
+    [[nodiscard]] double percentile(double p) const {
+        if (values.empty()) return 0.0;
+        const auto rank = static_cast<std::size_t>(std::ceil(p * static_cast<double>(values.size())));
+        return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+    }
+
+private:
+    std::vector<double> values;
+};
+
+/**
+ * @brief generates a tone in 10 ms frames(5 ms low delay frames in low latency mode) at real time pace,
+ * timestamped with the time of the first sample
+ */
+void run_synthetic_capture(const options& opts, packet_channel& channel, const std::atomic<bool>& running) {
+    const auto frame_us = opts.low_latency ? 5000 : 10000;
+    const int  application = opts.low_latency ? OPUS_APPLICATION_RESTRICTED_LOWDELAY : OPUS_APPLICATION_VOIP;
+
+    int  error;
+    auto encoder = opus_encoder_create(static_cast<opus_int32>(opts.sample_rate), 1, application, &error);
+    if (error != OPUS_OK) return;
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(static_cast<opus_int32>(opts.bitrate)));
+
+    const auto                frame_size = static_cast<int>(opts.sample_rate / 1000 * frame_us / 1000);
+    std::vector<float>        pcm(frame_size);
+    std::vector<std::uint8_t> packet(kMaxPacketSize);
+    double                    phase = 0.0;
+
+    auto frame_start = clock_type::now();
+    while (running.load(std::memory_order_relaxed)) {
+        // the frame is complete once its last sample is captured
+        std::this_thread::sleep_until(frame_start + std::chrono::microseconds(frame_us));
+
+        for (auto& sample : pcm) {
+            phase += 2.0 * 3.14159265358979323846 * 220.0 / opts.sample_rate;
+            sample = static_cast<float>(0.3 * std::sin(phase));
+        }
+        const auto len = opus_encode_float(encoder, pcm.data(), frame_size, packet.data(), kMaxPacketSize);
+        if (len > 0) {
+            channel.push(packet.data(), static_cast<std::size_t>(len), static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(frame_start.time_since_epoch()).count()));
+        }
+        frame_start += std::chrono::microseconds(frame_us);
+    }
+    opus_encoder_destroy(encoder);
+}
+
+bool parse_options(int argc, char** argv, options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--synthetic") {
+            opts.synthetic = true;
+            continue;
+        }
+        if (arg == "--low-latency") {
+            opts.low_latency = true;
+            continue;
+        }
+
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value) return false;
+
+        if (arg == "--seconds") opts.seconds = std::strtoul(value, nullptr, 10);
+        else if (arg == "--tick") opts.tick_ms = std::strtoul(value, nullptr, 10);
+        else if (arg == "--delay") opts.delay_ms = std::strtoul(value, nullptr, 10);
+        else if (arg == "--rate") opts.sample_rate = std::strtoul(value, nullptr, 10);
+        else if (arg == "--bitrate") opts.bitrate = std::strtoul(value, nullptr, 10);
+        else if (arg == "--input") opts.input_device = value;
+        else if (arg == "--output") opts.output_device = value;
+        else return false;
+        ++i;
+    }
+    // low latency streams queue 20 ms at most, so they are updated more often than a game tick
+    if (opts.tick_ms == 0) opts.tick_ms = opts.low_latency ? 2 : 10;
+    return true;
+}
+}
+
+int main(int argc, char** argv) {
+    options opts;
+    if (!parse_options(argc, argv, opts)) {
+        std::fprintf(stderr, "usage: %s [--seconds S] [--tick MS] [--delay MS] [--rate HZ] [--bitrate BPS]\n"
+                     "          [--input NAME] [--output NAME] [--synthetic] [--low-latency]\n", argv[0]);
+        return 1;
+    }
+
+    if (opts.synthetic && opts.output_device.empty()) {
+#ifdef _WIN32
+        _putenv_s("ALSOFT_DRIVERS", "null");
+#else
+        setenv("ALSOFT_DRIVERS", "null", 0);
+#endif
+    }
+
+    kvoice::sound_output_config output_config;
+    output_config.device_name = opts.output_device;
+    output_config.sample_rate = opts.sample_rate;
+    output_config.src_count = 1;
+    if (opts.low_latency) output_config.profile = kvoice::latency_profile::low_latency;
+
+    auto [output, output_error] = kvoice::create_sound_output(output_config);
+    if (!output) {
+        std::fprintf(stderr, "couldn't create sound output: %s\n", output_error.c_str());
+        return 1;
+    }
+    auto stream = output->create_stream();
+    stream->set_spatial_state(false);
+
+    packet_channel    channel;
+    std::atomic<bool> running{ true };
+    std::thread       synthetic_capture;
+
+    std::unique_ptr<kvoice::sound_input> input;
+    if (opts.synthetic) {
+        synthetic_capture = std::thread(run_synthetic_capture, std::cref(opts), std::ref(channel), std::cref(running));
+    } else {
+        kvoice::sound_input_config input_config;
+        input_config.device_name = opts.input_device;
+        input_config.sample_rate = opts.sample_rate;
+        input_config.bitrate = opts.bitrate;
+        if (opts.low_latency) input_config.profile = kvoice::latency_profile::low_latency;
+
+        auto [device, input_error] = kvoice::create_sound_input(input_config);
+        if (!device) {
+            std::fprintf(stderr, "couldn't create sound input: %s, try --synthetic\n", input_error.c_str());
+            return 1;
+        }
+        input = std::move(device);
+        input->set_timed_input_callback([&channel](const void* data, std::size_t size, std::uint64_t capture_us) {
+            channel.push(data, size, capture_us);
+        });
+        input->enable_input();
+    }
+
+    stage_samples capture_to_encoded;
+    stage_samples capture_to_push;
+    stage_samples push_to_playout;
+    stage_samples capture_to_playout;
+    std::uint64_t measured = 0;
+
+    const auto start = clock_type::now();
+    const auto stop_time = start + std::chrono::seconds(opts.seconds);
+    auto       tick = start;
+    while (tick < stop_time) {
+        std::this_thread::sleep_until(tick);
+
+        for (const auto& packet : channel.pop_ready(static_cast<std::uint64_t>(opts.delay_ms) * 1000)) {
+            capture_to_encoded.record(static_cast<double>(packet.encoded_us - packet.capture_us) / 1000.0);
+
+            const kvoice::opus_packet opus{ packet.data.data(), packet.data.size(), packet.capture_us };
+            stream->push_opus_buffers(&opus, 1);
+        }
+        stream->update();
+
+        // stats keep the last measured packet, a packet per tick is sampled
+        const auto stats = stream->get_stats();
+        if (stats.latency_samples != measured) {
+            measured = stats.latency_samples;
+            capture_to_push.record(stats.capture_to_push_ms);
+            push_to_playout.record(stats.push_to_playout_ms);
+            capture_to_playout.record(stats.capture_to_playout_ms);
+        }
+        tick += std::chrono::milliseconds(opts.tick_ms);
+    }
+
+    running.store(false, std::memory_order_relaxed);
+    if (synthetic_capture.joinable()) synthetic_capture.join();
+    if (input) input->disable_input();
+
+    const auto stats = stream->get_stats();
+    std::printf("%s capture, %u s, tick %u ms, network delay %u ms, %.1f ms target buffer, %llu underruns\n",
+                opts.synthetic ? "synthetic" : "device", opts.seconds, opts.tick_ms, opts.delay_ms,
+                stats.target_buffer_ms, static_cast<unsigned long long>(stats.underruns));
+    capture_to_encoded.print("capture->encoded");
+    capture_to_push.print("capture->push");
+    push_to_playout.print("push->playout");
+    capture_to_playout.print("capture->playout");
+
+    if (!opts.low_latency) return 0;
+    const auto p99 = capture_to_playout.percentile(0.99);
+    const bool met = !capture_to_playout.empty() && p99 < kLowLatencyTargetMs;
+    std::printf("low latency target %.0f ms: p99 %.2f ms, %s\n", kLowLatencyTargetMs, p99, met ? "met" : "missed");
+    return met ? 0 : 1;
+}
@@ -0,0 +1,398 @@
+#include "kvoice/kvoice.hpp"
+
+#include <opus.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <Windows.h>
+#   include <Psapi.h>
+#else
+#   include <sys/resource.h>
+#   include <unistd.h>
+#endif
+
+// Load generator for capacity planning: N talkers pushing opus packets into one sound_output,
+// driven like a game server tick. Uses the OpenAL Soft null backend unless a device is given.
+//
+//   kvoice-loadgen --streams 1000 --seconds 30 --loss 2 --jitter 40
+//   kvoice-loadgen --streams 5000 --log capture.kvpl
+
+namespace {
+using clock_type = std::chrono::steady_clock;
+
+constexpr auto kPacketMs = 20;
+constexpr auto kMaxPacketSize = 1500;
+
+struct options {
+    std::uint32_t streams{ 100 };
+    std::uint32_t seconds{ 10 };
+    std::uint32_t tick_ms{ 20 };
+    std::uint32_t sample_rate{ 48000 };
+    std::uint32_t bitrate{ 24000 };
+    float         loss_percent{ 0.f };
+    std::uint32_t jitter_ms{ 0 };
+    std::string   device{};
+    std::string   log_path{};
+};
+
+/**
+ * @brief log-linear latency histogram, 16 sub-buckets per power of two
+ */
+class latency_histogram {
+    static constexpr auto kSubBits = 4;
+    static constexpr auto kSubBuckets = 1u << kSubBits;
+    static constexpr auto kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+
+public:
+    void record(std::uint64_t ns) {
+        ++buckets[index(ns)];
+        ++total;
+        max_value = std::max(max_value, ns);
+    }
+
+    [[nodiscard]] std::uint64_t count() const { return total; }
+    [[nodiscard]] std::uint64_t max() const { return max_value; }
+
+    [[nodiscard]] std::uint64_t percentile(double p) const {
+        if (!total) return 0;
+        const auto    rank = static_cast<std::uint64_t>(std::ceil(p * static_cast<double>(total)));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < kBuckets; ++i) {
+            seen += buckets[i];
+            if (seen >= rank) return std::min(upper_bound(i), max_value);
+        }
+        return max_value;
+    }
+
+private:
+    static std::size_t index(std::uint64_t ns) {
+        if (ns < kSubBuckets) return static_cast<std::size_t>(ns);
+        int msb = 63;
+        while (!(ns >> msb)) --msb;
+        const int shift = msb - kSubBits;
+        return static_cast<std::size_t>((shift + 1) * kSubBuckets + ((ns >> shift) & (kSubBuckets - 1)));
+    }
+
+    static std::uint64_t upper_bound(std::size_t i) {
+        if (i < kSubBuckets) return i;
+        const auto shift = i / kSubBuckets - 1;
+        const auto sub = i % kSubBuckets;
+        return ((kSubBuckets + sub + 1) << shift) - 1;
+    }
+
+    std::array<std::uint64_t, kBuckets> buckets{};
+    std::uint64_t                       total{ 0 };
+    std::uint64_t                       max_value{ 0 };
+};
+
+struct talker {
+    std::unique_ptr<kvoice::stream> stream;
+    std::size_t                     next_packet{ 0 };
+    clock_type::time_point          next_due{};
+    std::uint64_t                   sent{ 0 };
+    std::uint64_t                   lost{ 0 };
+};
+
+double process_cpu_seconds() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+    const auto to_seconds = [](const FILETIME& t) {
+        return static_cast<double>((static_cast<std::uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime) * 1e-7;
+    };
+    return to_seconds(kernel) + to_seconds(user);
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+}
+
+std::uint64_t resident_bytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters{};
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.WorkingSetSize;
+#else
+    unsigned long size = 0, resident = 0;
+    if (auto* statm = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(statm, "%lu %lu", &size, &resident) != 2) resident = 0;
+        std::fclose(statm);
+    }
+    return static_cast<std::uint64_t>(resident) * static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+/**
+ * @brief encodes a few seconds of speech-like signal: talk spurts of harmonic tones with noise, and pauses
+ */
+std::vector<std::vector<std::uint8_t>> synthesize_packets(const options& opts) {
+    int  error;
+    auto encoder = opus_encoder_create(static_cast<opus_int32>(opts.sample_rate), 1, OPUS_APPLICATION_VOIP, &error);
+    if (error != OPUS_OK) return {};
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(static_cast<opus_int32>(opts.bitrate)));
+
+    const auto frame_size = static_cast<int>(opts.sample_rate / 1000 * kPacketMs);
+    const auto frames = 10000 / kPacketMs;
+
+    std::vector<float>                     pcm(frame_size);
+    std::vector<std::vector<std::uint8_t>> packets;
+    std::minstd_rand                       rng{ 1 };
+    std::uniform_real_distribution<float>  noise{ -0.02f, 0.02f };
+
+    double phase = 0.0;
+    for (int frame = 0; frame < frames; ++frame) {
+        // 1.5 s of talk followed by 0.5 s of silence
+        const bool   talking = frame % 100 < 75;
+        const double pitch = 110.0 + 40.0 * std::sin(frame * 0.05);
+        for (int i = 0; i < frame_size; ++i) {
+            float sample = noise(rng);
+            if (talking) {
+                phase += 2.0 * 3.14159265358979323846 * pitch / opts.sample_rate;
+                sample += static_cast<float>(0.3 * std::sin(phase) + 0.15 * std::sin(2 * phase) +
+                                             0.08 * std::sin(3 * phase));
+            }
+            pcm[i] = sample;
+        }
+
+        std::vector<std::uint8_t> packet(kMaxPacketSize);
+        const auto                len = opus_encode_float(encoder, pcm.data(), frame_size, packet.data(),
+                                                          kMaxPacketSize);
+        if (len > 0) {
+            packet.resize(len);
+            packets.push_back(std::move(packet));
+        }
+    }
+    opus_encoder_destroy(encoder);
+    return packets;
+}
+
+std::vector<std::vector<std::uint8_t>> load_packets(const std::string& path) {
+    std::vector<std::vector<std::uint8_t>> packets;
+
+    const kvoice::packet_log_reader reader{ path };
+    packets.reserve(reader.size());
+    for (std::size_t i = 0; i < reader.size(); ++i) {
+        const auto& entry = reader.entry(i);
+        const auto* payload = reader.payload(entry);
+        packets.emplace_back(payload, payload + entry.size);
+    }
+    return packets;
+}
+
+bool parse_options(int argc, char** argv, options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const char*       value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value) return false;
+
+        if (arg == "--streams") opts.streams = std::strtoul(value, nullptr, 10);
+        else if (arg == "--seconds") opts.seconds = std::strtoul(value, nullptr, 10);
+        else if (arg == "--tick") opts.tick_ms = std::strtoul(value, nullptr, 10);
+        else if (arg == "--rate") opts.sample_rate = std::strtoul(value, nullptr, 10);
+        else if (arg == "--bitrate") opts.bitrate = std::strtoul(value, nullptr, 10);
+        else if (arg == "--loss") opts.loss_percent = std::strtof(value, nullptr);
+        else if (arg == "--jitter") opts.jitter_ms = std::strtoul(value, nullptr, 10);
+        else if (arg == "--device") opts.device = value;
+        else if (arg == "--log") opts.log_path = value;
+        else return false;
+        ++i;
+    }
+    return opts.streams > 0 && opts.tick_ms > 0;
+}
+
+void print_latency(const char* name, const latency_histogram& histogram) {
+    std::printf("%-8s calls %12llu  p50 %8.2f us  p99 %8.2f us  p999 %8.2f us  max %8.2f us\n", name,
+                static_cast<unsigned long long>(histogram.count()), histogram.percentile(0.5) / 1000.0,
+                histogram.percentile(0.99) / 1000.0, histogram.percentile(0.999) / 1000.0,
+                histogram.max() / 1000.0);
+}
+}
+
+int main(int argc, char** argv) {
+    options opts;
+    if (!parse_options(argc, argv, opts)) {
+        std::fprintf(stderr, "usage: %s [--streams N] [--seconds S] [--tick MS] [--rate HZ] [--bitrate BPS]\n"
+                     "          [--loss PERCENT] [--jitter MS] [--device NAME] [--log PACKET_LOG]\n", argv[0]);
+        return 1;
+    }
+
+    if (opts.device.empty()) {
+#ifdef _WIN32
+        _putenv_s("ALSOFT_DRIVERS", "null");
+#else
+        setenv("ALSOFT_DRIVERS", "null", 0);
+#endif
+    }
+
+    std::vector<std::vector<std::uint8_t>> packets;
+    try {
+        packets = opts.log_path.empty() ? synthesize_packets(opts) : load_packets(opts.log_path);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    if (packets.empty()) {
+        std::fprintf(stderr, "no packets to send\n");
+        return 1;
+    }
+
+    kvoice::sound_output_config output_config;
+    output_config.device_name = opts.device;
+    output_config.sample_rate = opts.sample_rate;
+    output_config.src_count = opts.streams;
+
+    auto [output, error_msg] = kvoice::create_sound_output(output_config);
+    if (!output) {
+        std::fprintf(stderr, "couldn't create sound output: %s\n", error_msg.c_str());
+        return 1;
+    }
+
+    const auto rss_before = resident_bytes();
+
+    std::vector<talker> talkers(opts.streams);
+    const auto          start = clock_type::now() + std::chrono::milliseconds(100);
+    for (std::size_t i = 0; i < talkers.size(); ++i) {
+        talkers[i].stream = output->create_stream();
+        talkers[i].stream->set_min_distance(1.f);
+        talkers[i].stream->set_max_distance(50.f);
+        // spread packet phases and positions in the recording across talkers
+        talkers[i].next_packet = (i * 37) % packets.size();
+        talkers[i].next_due = start + std::chrono::microseconds((i * 997) % (kPacketMs * 1000));
+    }
+
+    const auto rss_streams = resident_bytes();
+    const auto cpu_start = process_cpu_seconds();
+    const auto stop_time = start + std::chrono::seconds(opts.seconds);
+
+    std::atomic<bool> running{ true };
+    latency_histogram push_latency;
+    std::uint64_t     pushed_bytes = 0;
+
+    // network thread: pushes packets at 20 ms cadence with random loss and arrival jitter
+    std::thread feeder([&]() {
+        std::minstd_rand                      rng{ 7 };
+        std::uniform_real_distribution<float> loss{ 0.f, 100.f };
+        std::uniform_int_distribution<int>    jitter{ 0, static_cast<int>(opts.jitter_ms) * 1000 };
+
+        std::vector<clock_type::time_point> nominal(talkers.size());
+        for (std::size_t i = 0; i < talkers.size(); ++i) nominal[i] = talkers[i].next_due;
+
+        while (running.load(std::memory_order_relaxed)) {
+            const auto now = clock_type::now();
+            auto       next_wakeup = now + std::chrono::milliseconds(1);
+
+            for (std::size_t i = 0; i < talkers.size(); ++i) {
+                auto& t = talkers[i];
+                while (t.next_due <= now) {
+                    const auto& packet = packets[t.next_packet];
+                    t.next_packet = (t.next_packet + 1) % packets.size();
+
+                    if (loss(rng) < opts.loss_percent) {
+                        ++t.lost;
+                    } else {
+                        const auto push_start = clock_type::now();
+                        t.stream->push_opus_buffer(packet.data(), packet.size());
+                        push_latency.record(static_cast<std::uint64_t>(
+                            std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - push_start)
+                            .count()));
+                        pushed_bytes += packet.size();
+                        ++t.sent;
+                    }
+
+                    nominal[i] += std::chrono::milliseconds(kPacketMs);
+                    t.next_due = nominal[i] + std::chrono::microseconds(opts.jitter_ms ? jitter(rng) : 0);
+                }
+                next_wakeup = std::min(next_wakeup, t.next_due);
+            }
+            std::this_thread::sleep_until(next_wakeup);
+        }
+    });
+
+    // game thread: moves talkers and updates streams every tick
+    latency_histogram update_latency;
+    latency_histogram tick_latency;
+    std::uint64_t     update_failures = 0;
+
+    auto        tick = start;
+    std::size_t tick_number = 0;
+    while (tick < stop_time) {
+        std::this_thread::sleep_until(tick);
+        const auto tick_start = clock_type::now();
+
+        const float angle = static_cast<float>(tick_number) * 0.01f;
+        for (std::size_t i = 0; i < talkers.size(); ++i) {
+            auto&       s = *talkers[i].stream;
+            const float radius = 2.f + static_cast<float>(i % 40);
+            const float a = angle + static_cast<float>(i);
+            s.set_position({ radius * std::cos(a), 0.f, radius * std::sin(a) });
+            s.set_velocity({ -std::sin(a), 0.f, std::cos(a) });
+
+            const auto update_start = clock_type::now();
+            if (!s.update()) ++update_failures;
+            update_latency.record(static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - update_start).count()));
+        }
+
+        tick_latency.record(static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - tick_start).count()));
+        tick += std::chrono::milliseconds(opts.tick_ms);
+        ++tick_number;
+    }
+
+    running.store(false, std::memory_order_relaxed);
+    feeder.join();
+
+    const auto cpu_seconds = process_cpu_seconds() - cpu_start;
+    const auto wall_seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    const auto rss_after = resident_bytes();
+
+    std::uint64_t sent = 0, lost = 0, underruns = 0, overruns = 0, decode_errors = 0, decoded = 0;
+    double        buffered_ms = 0.0;
+    for (const auto& t : talkers) {
+        const auto stats = t.stream->get_stats();
+        sent += t.sent;
+        lost += t.lost;
+        underruns += stats.underruns;
+        overruns += stats.overrun_samples;
+        decode_errors += stats.decode_errors;
+        decoded += stats.decoded_packets;
+        buffered_ms += stats.buffered_ms;
+    }
+    const auto n = static_cast<double>(talkers.size());
+
+    std::printf("streams %u, %.1f s, tick %u ms, loss %.1f%%, jitter %u ms, %zu source packets\n", opts.streams,
+                wall_seconds, opts.tick_ms, opts.loss_percent, opts.jitter_ms, packets.size());
+    std::printf("throughput      %.0f packets/s, %.2f Mbit/s, %.0f decoded packets/s\n", sent / wall_seconds,
+                pushed_bytes * 8.0 / wall_seconds / 1e6, decoded / wall_seconds);
+    std::printf("cpu             %.1f%% of one core total, %.4f%% per stream\n", 100.0 * cpu_seconds / wall_seconds,
+                100.0 * cpu_seconds / wall_seconds / n);
+    std::printf("memory          %.1f KiB per stream at creation, %.1f KiB per stream after run\n",
+                static_cast<double>(rss_streams - rss_before) / n / 1024.0,
+                static_cast<double>(rss_after - rss_before) / n / 1024.0);
+    std::printf("stream health   %llu lost, %llu underruns, %llu overrun samples, %llu decode errors, "
+                "%llu failed updates, %.1f ms avg buffered\n", static_cast<unsigned long long>(lost),
+                static_cast<unsigned long long>(underruns), static_cast<unsigned long long>(overruns),
+                static_cast<unsigned long long>(decode_errors), static_cast<unsigned long long>(update_failures),
+                buffered_ms / n);
+    print_latency("push", push_latency);
+    print_latency("update", update_latency);
+    print_latency("tick", tick_latency);
+    return 0;
+}
@@ -0,0 +1,231 @@
+#include "ringbuffer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#   include <pthread.h>
+#   include <sched.h>
+#endif
+
+// Stress test and throughput benchmark of the stream ring buffer. One producer and one consumer thread move
+// a counting sequence through the ring with every access pattern kvoice uses and abort on the first value out
+// of order. Build with -fsanitize=thread to check memory ordering, the legacy configuration(fake_tso, no
+// padding) is benchmarked only without sanitizers, it races by design.
+//
+//   kvoice-ring-stress --seconds 10
+//   kvoice-ring-stress --seconds 5 --bench --cpus 0,1
+
+namespace {
+using clock_type = std::chrono::steady_clock;
+
+// same size as stream_impl ring, 16 MB legacy + hardened instances are heap allocated
+constexpr auto kRingSize = 262144;
+constexpr auto kMaxBlock = 5760;
+
+enum class access_pattern {
+    element,
+    bulk,
+    spans
+};
+
+constexpr const char* kPatternNames[] = { "element", "bulk", "spans" };
+
+struct options {
+    std::uint32_t seconds{ 5 };
+    bool          bench{ false };
+    int           producer_cpu{ -1 };
+    int           consumer_cpu{ -1 };
+};
+
+struct run_result {
+    std::uint64_t items{ 0 };
+    double        seconds{ 0.0 };
+};
+
+void pin_thread(int cpu) {
+#ifdef __linux__
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    static_cast<void>(cpu);
+#endif
+}
+
+[[noreturn]] void fail(const char* pattern, std::uint64_t expected, std::uint64_t got) {
+    std::fprintf(stderr, "%s: expected %llu, got %llu\n", pattern, static_cast<unsigned long long>(expected),
+                 static_cast<unsigned long long>(got));
+    std::abort();
+}
+
+template <typename RingT>
+void produce(RingT& ring, access_pattern pattern, const std::atomic<bool>& running, std::uint64_t& produced) {
+    std::minstd_rand                             rng{ 1 };
+    std::uniform_int_distribution<std::size_t>   block_size(1, kMaxBlock);
+    std::unique_ptr<std::uint64_t[]>             block(new std::uint64_t[kMaxBlock]);
+    std::uint64_t                                next = 0;
+
+    while (running.load(std::memory_order_relaxed)) {
+        switch (pattern) {
+        case access_pattern::element:
+            if (ring.insert(next)) ++next;
+            break;
+        case access_pattern::bulk: {
+            const auto count = block_size(rng);
+            for (std::size_t i = 0; i < count; ++i) block[i] = next + i;
+            next += ring.writeBuff(block.get(), count);
+            break;
+        }
+        case access_pattern::spans: {
+            const auto count = block_size(rng);
+            auto       spans = ring.peekWrite(count);
+            const auto first = std::min(count, spans.first_size);
+            const auto second = std::min(count - first, spans.second_size);
+            for (std::size_t i = 0; i < first; ++i) spans.first[i] = next++;
+            for (std::size_t i = 0; i < second; ++i) spans.second[i] = next++;
+            ring.commitWrite(first + second);
+            break;
+        }
+        }
+    }
+    produced = next;
+}
+
+template <typename RingT>
+void consume(RingT& ring, access_pattern pattern, const std::atomic<bool>& producing, std::uint64_t& consumed) {
+    const char*                                name = kPatternNames[static_cast<int>(pattern)];
+    std::minstd_rand                           rng{ 2 };
+    std::uniform_int_distribution<std::size_t> block_size(1, kMaxBlock);
+    std::unique_ptr<std::uint64_t[]>           block(new std::uint64_t[kMaxBlock]);
+    std::uint64_t                              next = 0;
+
+    // drain what is left after the producer stops
+    for (;;) {
+        const bool    last_pass = !producing.load(std::memory_order_acquire);
+        std::uint64_t got = 0;
+
+        switch (pattern) {
+        case access_pattern::element: {
+            std::uint64_t value;
+            while (ring.remove(&value)) {
+                if (value != next) fail(name, next, value);
+                ++next;
+                ++got;
+            }
+            break;
+        }
+        case access_pattern::bulk: {
+            const auto count = ring.readBuff(block.get(), block_size(rng));
+            for (std::size_t i = 0; i < count; ++i) {
+                if (block[i] != next) fail(name, next, block[i]);
+                ++next;
+            }
+            got = count;
+            break;
+        }
+        case access_pattern::spans: {
+            const auto spans = ring.peekRead(block_size(rng));
+            for (std::size_t i = 0; i < spans.first_size; ++i, ++next)
+                if (spans.first[i] != next) fail(name, next, spans.first[i]);
+            for (std::size_t i = 0; i < spans.second_size; ++i, ++next)
+                if (spans.second[i] != next) fail(name, next, spans.second[i]);
+            ring.commitRead(spans.size());
+            got = spans.size();
+            break;
+        }
+        }
+
+        if (last_pass && got == 0) break;
+    }
+    consumed = next;
+}
+
+template <typename RingT>
+run_result run(access_pattern pattern, const options& opts, std::chrono::milliseconds duration) {
+    auto              ring = std::make_unique<RingT>();
+    std::atomic<bool> running{ true };
+    std::atomic<bool> producing{ true };
+    std::uint64_t     produced = 0;
+    std::uint64_t     consumed = 0;
+
+    const auto start = clock_type::now();
+    std::thread consumer([&] {
+        pin_thread(opts.consumer_cpu);
+        consume(*ring, pattern, producing, consumed);
+    });
+    std::thread producer([&] {
+        pin_thread(opts.producer_cpu);
+        produce(*ring, pattern, running, produced);
+        producing.store(false, std::memory_order_release);
+    });
+
+    std::this_thread::sleep_for(duration);
+    running = false;
+    producer.join();
+    consumer.join();
+    const std::chrono::duration<double> elapsed = clock_type::now() - start;
+
+    if (produced != consumed) fail(kPatternNames[static_cast<int>(pattern)], produced, consumed);
+    return { consumed, elapsed.count() };
+}
+
+template <typename RingT>
+void run_all(const char* name, const options& opts) {
+    const auto per_pattern = std::chrono::milliseconds{ opts.seconds * 1000 / 3 };
+    for (const auto pattern : { access_pattern::element, access_pattern::bulk, access_pattern::spans }) {
+        const auto result = run<RingT>(pattern, opts, per_pattern);
+        std::printf("%-9s %-8s %14llu items  %10.2f Mitems/s\n", name, kPatternNames[static_cast<int>(pattern)],
+                    static_cast<unsigned long long>(result.items),
+                    static_cast<double>(result.items) / result.seconds / 1e6);
+    }
+}
+
+bool parse_options(int argc, char** argv, options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--bench") {
+            opts.bench = true;
+            continue;
+        }
+
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value) return false;
+
+        if (arg == "--seconds") opts.seconds = std::strtoul(value, nullptr, 10);
+        else if (arg == "--cpus") {
+            char* end = nullptr;
+            opts.producer_cpu = static_cast<int>(std::strtol(value, &end, 10));
+            if (*end != ',') return false;
+            opts.consumer_cpu = static_cast<int>(std::strtol(end + 1, nullptr, 10));
+        } else return false;
+        ++i;
+    }
+    return opts.seconds > 0;
+}
+}
+
+int main(int argc, char** argv) {
+    options opts;
+    if (!parse_options(argc, argv, opts)) {
+        std::fprintf(stderr, "usage: %s [--seconds S] [--bench] [--cpus PRODUCER,CONSUMER]\n", argv[0]);
+        return 1;
+    }
+
+    std::printf("ring of %d uint64, %u hardware threads, %s\n", kRingSize, std::thread::hardware_concurrency(),
+                opts.bench ? "benchmark" : "stress");
+
+    run_all<jnk0le::Ringbuffer<std::uint64_t, kRingSize, false, kvoice::kCacheLineSize>>("hardened", opts);
+    if (opts.bench) run_all<jnk0le::Ringbuffer<std::uint64_t, kRingSize, true>>("legacy", opts);
+    return 0;
+}